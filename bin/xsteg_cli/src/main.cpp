@@ -4,8 +4,15 @@
 #include <chrono>
 #include <cctype>
 #include <fstream>
+#include <memory>
 #include <mutex>
 
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif
+
+#include <xsteg/capacity_planner.hpp>
 #include <xsteg/steganographer.hpp>
 #include <xsteg/task_queue.hpp>
 
@@ -88,6 +95,24 @@ void require_resize_values(main_args& args)
     }
 }
 
+carrier_loading carrier_loading_of(main_args& args)
+{
+    return args.stream_input ? carrier_loading::streamed : carrier_loading::whole;
+}
+
+// '-' reads the input image from stdin
+std::unique_ptr<steganographer> open_steganographer(main_args& args, carrier_loading loading)
+{
+    if(args.input_img == "-")
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        return std::make_unique<steganographer>(stdin);
+    }
+    return std::make_unique<steganographer>(args.input_img, loading);
+}
+
 std::string generate_key(main_args& args)
 {
     require_thresholds(args);
@@ -114,17 +139,21 @@ void encode(main_args& args)
     require_output_image(args);
     require_data(args);
 
-    steganographer steg(args.input_img);
+    auto steg = open_steganographer(args, carrier_loading_of(args));
 
     if(!args.restore_key.empty()) { restore_key(args); }
 
     for(auto& th : args.thresholds)
     {
-        steg.add_threshold(th.data_type, th.direction, th.value, th.bits);
+        steg->add_threshold(th.data_type, th.direction, th.value, th.bits);
     }
 
-    steg.write_data(args.data.data(), args.data.size());
-    steg.save_to_file(args.output_img);
+    image_save_options opt;
+    opt.format = args.output_img_format;
+    opt.png_compression_level = args.output_img_png_level;
+
+    steg->write_data(args.data.data(), args.data.size());
+    steg->save_to_file(args.output_img, opt);
 }
 
 void decode(main_args& args)
@@ -136,16 +165,17 @@ void decode(main_args& args)
         require_output_file(args);
     }
 
-    steganographer steg(args.input_img);
+    // Only the rows up to the end of the data are ever decoded
+    auto steg = open_steganographer(args, carrier_loading::streamed);
 
     if(!args.restore_key.empty()) { restore_key(args); }
 
     for(auto& th : args.thresholds)
     {
-        steg.add_threshold(th.data_type, th.direction, th.value, th.bits);
+        steg->add_threshold(th.data_type, th.direction, th.value, th.bits);
     }
 
-    auto data = steg.read_data();
+    auto data = steg->read_data();
     if(args.output_std)
     {
         std::string str(reinterpret_cast<char*>(data.data()), data.size());
@@ -173,6 +203,7 @@ void diff_map(main_args& args)
     image_save_options opt;
     opt.format = args.output_img_format;
     opt.jpeg_quality = args.output_img_jpeg_quality;
+    opt.png_compression_level = args.output_img_png_level;
 
     diff_map.write_to_file(args.output_img, opt);
 }
@@ -193,8 +224,17 @@ void vdata_maps(main_args& args)
     image_save_options opt;
     opt.format = args.output_img_format;
     opt.jpeg_quality = args.output_img_jpeg_quality;
+    opt.png_compression_level = args.output_img_png_level;
 
-    std::string file_ext = (opt.format == image_format::png) ? ".png" : ".jpg";
+    std::string file_ext;
+    switch(opt.format)
+    {
+        case image_format::png:     { file_ext = ".png"; break; }
+        case image_format::jpeg:    { file_ext = ".jpg"; break; }
+        case image_format::pam:     { file_ext = ".pam"; break; }
+        case image_format::bmp:     { file_ext = ".bmp"; break; }
+        case image_format::tga:     { file_ext = ".tga"; break; }
+    }
 
     task_queue tq;
 
@@ -279,6 +319,45 @@ void gen_key(main_args args)
     }
 }
 
+void plan_key(main_args args)
+{
+    require_input_image(args);
+    if(args.plan_bits.empty())
+    {
+        std::cout << "No channel bits to plan with, aborting..." << std::endl;
+        exit(-1);
+    }
+
+    size_t payload_size = args.data.empty() ? args.payload_size : args.data.size();
+    if(payload_size == 0)
+    {
+        std::cout << "No data or payload size to plan for, aborting..." << std::endl;
+        exit(-1);
+    }
+
+    image img(args.input_img);
+    capacity_planner planner(&img);
+    capacity_plan plan = planner.plan(payload_size, args.plan_type, args.plan_direction, args.plan_bits);
+    std::string key = capacity_planner::plan_key(plan);
+
+    std::cout << "Planned [" << plan.pixel_count << "] pixels, holding [" 
+              << plan.data_space << "]b" << std::endl;
+
+    if(!args.output_file.empty())
+    {
+        std::ofstream ofs(args.output_file);
+        if(ofs)
+        {
+            ofs << key;
+            ofs.close();
+        }
+    }
+    else
+    {
+        std::cout << std::endl << key << std::endl;
+    }
+}
+
 void resize_abs(main_args args)
 {
     require_input_image(args);
@@ -325,6 +404,7 @@ int main(int argc, char** argv)
 		case encode_mode::VDATA_MAPS: { vdata_maps(margs); break; }
 		case encode_mode::HELP: { std::cout << help_text << std::endl; break; }
 		case encode_mode::GENERATE_KEY: { gen_key(margs); break; }
+		case encode_mode::PLAN_KEY: { plan_key(margs); break; }
 		case encode_mode::RESIZE_ABSOLUTE: { resize_abs(margs); break; }
 		case encode_mode::RESIZE_PROPORTIONAL: { resize_pro(margs); break; }
 		}
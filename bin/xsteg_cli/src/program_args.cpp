@@ -69,6 +69,18 @@ main_args parse_main_args(int argc, char** argv)
             {
                 result.output_img_format = image_format::png;
             }
+            else if(fmtstr == "PAM")
+            {
+                result.output_img_format = image_format::pam;
+            }
+            else if(fmtstr == "BMP")
+            {
+                result.output_img_format = image_format::bmp;
+            }
+            else if(fmtstr == "TGA")
+            {
+                result.output_img_format = image_format::tga;
+            }
             else
             {
                 std::cout << "Invalid image format: '" << fmtstr << "', aborting...";
@@ -79,6 +91,10 @@ main_args parse_main_args(int argc, char** argv)
         {
             result.output_img_jpeg_quality = std::stoi(next_arg());
         }
+        else if(arg == "-oic")
+        {
+            result.output_img_png_level = std::stoi(next_arg());
+        }
         else if(arg == "-ra")
         { 
             result.mode = encode_mode::RESIZE_ABSOLUTE;
@@ -107,6 +123,31 @@ main_args parse_main_args(int argc, char** argv)
             threshold.bits = parse_px_availability_bits(bits);
             result.thresholds.push_back(threshold);
         }
+        else if(arg == "-pk")
+        {
+            result.mode = encode_mode::PLAN_KEY;
+            std::string type = next_arg();
+            std::string dir  = next_arg();
+            std::string bits = next_arg();
+            strutils::to_upper_in_place(type);
+            strutils::to_upper_in_place(dir);
+
+            result.plan_type = visual_data_type_name_map.at(type);
+            result.plan_direction = threshold_direction_name_map.at(dir);
+            for(auto& mask : strutils::split_view(std::string_view(bits), ','))
+            {
+                if(mask.size() < 4)
+                {
+                    std::cout << "Invalid channel bits: '" << mask << "', aborting...";
+                    exit(-1);
+                }
+                result.plan_bits.push_back(parse_px_availability_bits(std::string(mask)));
+            }
+        }
+        else if(arg == "-ps")
+        {
+            result.payload_size = std::stoull(next_arg());
+        }
         else if(arg == "-df")
         {
             std::string datafile = next_arg();
@@ -130,6 +171,10 @@ main_args parse_main_args(int argc, char** argv)
         {
             result.restore_key = next_arg();
         }
+        else if(arg == "-st")
+        {
+            result.stream_input = true;
+        }
     }
     return result;
 }
@@ -151,6 +196,7 @@ Encoding mode arguments (pick one)\n\
     '-m':  Diff-map\n\
     '-vd': Generate visual-data maps\n\
     '-gk': Generate thresholds key\n\
+    '-pk': Plan a thresholds key that fits the data (see below)\n\
 \n\
 Resize mode arguments\n\
 ----------------------\n\
@@ -184,17 +230,26 @@ Threshold '-t' specification (-t [0](visual_data) [1](direction) [2](orb_mask) [
 \n\
     [3]: Threshold value from 0.00 to 1.00\n\
 \n\
+Key planning '-pk' specification (-pk [0](visual_data) [1](direction) [2](orb_masks)):\n\
+    [0], [1]: Same as the threshold specification\n\
+    [2]: Comma separated channel bit sequences allowed, e.g. '1110,2221'\n\
+    Finds the most selective threshold value able to hold the data (-df, -x)\n\
+    or a payload size in bytes (-ps), using the mask with the fewest bits.\n\
+\n\
 Other arguments\n\
 ---------------\n\
 \n\
-'-ii': Input image file-path\n\
-'-oi': Output image file-path (encoding, exclusively png format)\n\
-'-oif': Output image format (either PNG or JPEG)\n\
+'-ii': Input image file-path, '-' reads it from stdin (encoding, decoding)\n\
+'-oi': Output image file-path (encoding: png, pam, bmp or tga)\n\
+'-oif': Output image format (PNG, JPEG, or the uncompressed PAM, BMP, TGA)\n\
 '-oiq': Output image quality (1-100, exclusive to JPEG format)\n\
+'-oic': Output image compression level (0-9, exclusive to PNG format)\n\
 '-of': Output file-path (decoding)\n\
 '-x' : Direct text-data input (encoding, not-recommended)\n\
 '-df': Input data file (encoding)\n\
 '-rk': Restore thresholds from key-string\n\
+'-ps': Payload size in bytes (key planning)\n\
+'-st': Stream the input image row by row instead of loading it whole (encoding)\n\
 '-v' : Verbose mode\n\
 '-nomt': Disable multithreading\n\
 \n\
@@ -207,6 +262,9 @@ Command examples\n\
 - Decode contents of an image with encoded data within:\n\
     xsteg -d -t SATURATION UP 1110 0.5 -ii image.encoded.png -of text.decoded.txt\n\
 \n\
+- Decode contents of an image while it is being downloaded:\n\
+    curl -s https://example.com/image.encoded.png | xsteg -d -t SATURATION UP 1110 0.5 -ii - -o\n\
+\n\
 - Generate visual data maps for an image:\n\
     xsteg -vd -ii image.jpg\n\
 \n\
@@ -223,6 +281,9 @@ xsteg.exe -gk\n\
 output: &S>A*1110+0.344&0>A*1000+0.5&1>A*0100+0.5&2>A*0010+0.5\n\
 ---------------------------------------------------------------\n\
 \n\
+- Plan a key able to hold a data file, with 1 or 2 bits per color channel:\n\
+xsteg -pk SATURATION UP 1110,2221 -ii image.jpg -df data.txt\n\
+\n\
 - Generate a encoding/deconding key from a list of thresholds and save it to a file:\n\
 xsteg.exe -gk \n\
     -t SATURATION UP 1110 0.344\n\
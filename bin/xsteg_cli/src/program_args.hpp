@@ -14,6 +14,7 @@ enum class encode_mode
     DIFF_MAP,
     VDATA_MAPS,
     GENERATE_KEY,
+    PLAN_KEY,
     RESIZE_ABSOLUTE,
     RESIZE_PROPORTIONAL,
     HELP
@@ -32,7 +33,13 @@ struct main_args
     std::string restore_key;
     xsteg::image_format output_img_format = xsteg::image_format::png;
     int output_img_jpeg_quality = static_cast<int>(xsteg::jpeg_quality::very_high);
+    int output_img_png_level = xsteg::image_save_options().png_compression_level;
     float resize_w = 0, resize_h = 0;
+    xsteg::visual_data_type plan_type = xsteg::visual_data_type::COLOR_RED;
+    xsteg::threshold_direction plan_direction = xsteg::threshold_direction::UP;
+    std::vector<xsteg::pixel_availability> plan_bits;
+    size_t payload_size = 0;
+    bool stream_input = false;
 };
 
 extern const std::map<std::string, xsteg::visual_data_type> visual_data_type_name_map;
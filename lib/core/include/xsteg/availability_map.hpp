@@ -1,11 +1,14 @@
 #pragma once
 
 #include <xsteg/image.hpp>
+#include <xsteg/packed_availability_map.hpp>
 #include <xsteg/visual_data.hpp>
 #include <xsteg/pixel_availability.hpp>
 
 #include <cinttypes>
+#include <limits>
 #include <map>
+#include <memory>
 #include <vector>
 
 namespace xsteg
@@ -24,6 +27,20 @@ namespace xsteg
         pixel_availability bits;
     };
 
+    // Span of pixels worth visiting when embedding or extracting. Runs start and
+    // end on usable pixels, but may contain short gaps of unusable ones.
+    // 'bit_offset' is the capacity of every run before this one.
+    struct availability_run
+    {
+        size_t first_px = 0;
+        size_t px_count = 0;
+        size_t bit_offset = 0;
+        size_t bit_count = 0;
+    };
+
+    class image_reader;
+    class threshold_engine;
+
     extern std::vector<availability_threshold> parse_thresholds_key(const std::string& key);
     extern std::string generate_thresholds_key(std::vector<availability_threshold>);
 
@@ -31,13 +48,21 @@ namespace xsteg
     {
     private:
         const image* _img = nullptr;
-        std::vector<pixel_availability> _map;
+        packed_availability_map _map;
+        std::vector<availability_run> _runs;
+        std::unique_ptr<threshold_engine> _engine;
         std::vector<availability_threshold> _thresholds;
         pixel_availability _max_threshold_bits;
         bool _modified = true;
+        bool _run_open = false;
+        size_t _run_gap_px = 0;
+        size_t _evaluated_px = 0;
+        size_t _next_chunk_px = 0;
 
     public:
-        availability_map(const image* imgptr);
+        // Without an image, only key handling and image_reader passes are available
+        availability_map(const image* imgptr = nullptr);
+        ~availability_map();
 
         void add_threshold(
             visual_data_type type, 
@@ -47,10 +72,29 @@ namespace xsteg
 
         void apply_thresholds();
 
-        const std::vector<pixel_availability>& available_map() const;
+        // Evaluates the thresholds row by row only until 'bits' of data space are
+        // found or the image ends. Returns the data space found so far.
+        size_t ensure_data_space(size_t bits);
+
+        const packed_availability_map& available_map() const;
+        const std::vector<availability_run>& available_runs() const;
+
+        // Index of the run holding the given data bit, or the run count if out of range
+        size_t find_run(size_t bit_idx) const;
 
         size_t available_data_space();
 
+        // Data space of the whole image, counted without building the map
+        size_t count_data_space() const;
+
+        // Data space of the rows left in 'reader', which stops being read once
+        // 'max_bits' are found. The image is never held whole.
+        size_t count_data_space(
+            image_reader& reader, 
+            size_t max_bits = std::numeric_limits<size_t>::max()) const;
+
+        const std::vector<availability_threshold>& thresholds() const;
+
         const image* image_ptr() const;
 
         std::string generate_key();
@@ -60,11 +104,20 @@ namespace xsteg
 
         static std::vector<availability_threshold> parse_key(const std::string& key);
 
+        // Embed masks (see pixel_bits.hpp) of 'px_count' RGBA pixels, using the worker pool
+        static void evaluate_masks(
+            const threshold_engine& engine, 
+            const uint8_t* px, 
+            size_t px_count, 
+            uint32_t* masks);
+
     private:
-        typedef std::map<visual_data_type, std::vector<float>> _vdata_map_map_t;
+        void reset_evaluation();
+        void evaluate_until(size_t to_px);
+        size_t evaluated_data_space() const;
 
-        void apply_thresholds_st();
-        void apply_thresholds_mt(unsigned int thread_count);
-        void apply_thresholds_segment(size_t from_px, size_t to_px, const _vdata_map_map_t& vdata_maps);
+        void apply_thresholds_segment(size_t from_px, size_t to_px, const threshold_engine& engine);
+        void reset_packed_map();
+        void build_runs(size_t from_px, size_t to_px);
     };
 }
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+namespace xsteg
+{
+    class bit_reader
+    {
+    private:
+        const uint8_t* _data_ptr = nullptr;
+        size_t _len = 0;
+        size_t _next_byte = 0;
+        uint64_t _buffer = 0;
+        size_t _buffer_bits = 0;
+
+    public:
+        bit_reader(const uint8_t* data_ptr, size_t len);
+
+        void seek(size_t bit_idx);
+
+        // Returns the next 'count' (0 to 32) bits, MSB first, right-aligned.
+        // Bits past the end of the data are read as zero.
+        inline uint32_t read(size_t count)
+        {
+            if(count == 0) { return 0; }
+            if(_buffer_bits < count) { refill(); }
+
+            uint32_t result = static_cast<uint32_t>(_buffer >> (64 - count));
+            _buffer <<= count;
+            _buffer_bits -= count;
+            return result;
+        }
+
+    private:
+        inline void refill()
+        {
+            while(_buffer_bits <= 56)
+            {
+                uint64_t byte = (_next_byte < _len) ? _data_ptr[_next_byte] : 0;
+                _buffer |= byte << (56 - _buffer_bits);
+                _buffer_bits += 8;
+                ++_next_byte;
+            }
+        }
+    };
+}
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <cinttypes>
+#include <cstddef>
 #include <vector>
 
 namespace xsteg
 {
     extern std::vector<bool> get_last_bits(uint8_t byte, size_t bits);
-    extern void set_last_bits(uint8_t* byteptr, const std::vector<bool>& bits);    
+    extern void set_last_bits(uint8_t* byteptr, const std::vector<bool>& bits);
+    extern void set_last_bits(uint8_t* byteptr, uint8_t bits, size_t count);
     extern bool get_bit(uint8_t byte, size_t idx);
     extern std::vector<uint8_t> get_bytes_from_bits(const std::vector<bool>& data, size_t offset_bytes);
 }
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+namespace xsteg
+{
+    class bit_writer
+    {
+    private:
+        uint8_t* _data_ptr = nullptr;
+        size_t _len = 0;
+        size_t _next_byte = 0;
+        uint64_t _buffer = 0;
+        size_t _buffer_bits = 0;
+
+    public:
+        bit_writer(uint8_t* data_ptr, size_t len);
+
+        // Appends the lowest 'count' (0 to 32) bits of 'bits', MSB first.
+        // Bits past the end of the destination are discarded.
+        inline void write(uint32_t bits, size_t count)
+        {
+            if(count == 0) { return; }
+
+            uint64_t val = bits & (0xFFFFFFFFu >> (32 - count));
+            _buffer |= val << (64 - _buffer_bits - count);
+            _buffer_bits += count;
+            if(_buffer_bits >= 32) { drain(); }
+        }
+
+        // Writes any pending partial byte, zero padded
+        void flush();
+
+        size_t position() const;
+
+    private:
+        inline void drain()
+        {
+            while(_buffer_bits >= 8)
+            {
+                if(_next_byte < _len)
+                {
+                    _data_ptr[_next_byte] = static_cast<uint8_t>(_buffer >> 56);
+                }
+                _buffer <<= 8;
+                _buffer_bits -= 8;
+                ++_next_byte;
+            }
+        }
+    };
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <xsteg/availability_map.hpp>
+#include <xsteg/image.hpp>
+#include <xsteg/pixel_availability.hpp>
+#include <xsteg/visual_data.hpp>
+
+#include <vector>
+
+namespace xsteg
+{
+    struct capacity_plan
+    {
+        availability_threshold threshold;
+        size_t pixel_count = 0;
+        size_t data_space = 0;
+    };
+
+    /*
+     * Picks a single threshold able to hold a payload of a given size. Allowed
+     * bit masks are tried from the fewest to the most bits per pixel, and the
+     * first one that fits is used with the most conservative threshold value,
+     * the one selecting the fewest pixels. Values are found by binary search
+     * over the cumulative visual data histogram of the image.
+     */
+    class capacity_planner
+    {
+    private:
+        const image* _img = nullptr;
+
+    public:
+        explicit capacity_planner(const image* img);
+
+        // Throws std::overflow_error when no allowed mask can hold the payload
+        capacity_plan plan(
+            size_t payload_bytes,
+            visual_data_type type,
+            threshold_direction direction,
+            std::vector<pixel_availability> allowed_bits) const;
+
+        // Plan as a key for availability_map::restore_from_key
+        static std::string plan_key(const capacity_plan& plan);
+    };
+}
@@ -2,19 +2,28 @@
 
 #include <array>
 #include <cinttypes>
+#include <limits>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace xsteg
 {
     class image;
     class image_pixel_view;
     class image_reader;
+    class mapped_file;
     struct pixel_availability;
 
     enum class image_format
     {
         png,
-        jpeg
+        jpeg,
+        // Uncompressed and lossless, for handing images between tools
+        // without the cost of compression: netpbm RGBA, 32-bit BMP and TGA
+        pam,
+        bmp,
+        tga
     };
 
     enum class jpeg_quality : int
@@ -28,11 +37,40 @@ namespace xsteg
         maximum = 100
     };
 
+    enum class png_filter : uint8_t
+    {
+        none = 0,
+        sub = 1,
+        up = 2,
+        average = 3,
+        paeth = 4
+    };
+
+    // How the png writer picks the filter of each row
+    enum class png_filter_selection
+    {
+        // Lowest sum of absolute filtered values over the whole row
+        exhaustive,
+        // Same, scored on a sample of the row only
+        sampled,
+        // Always the fixed filter
+        fixed
+    };
+
     struct image_save_options
     {
         image_format format = image_format::png;
         int jpeg_quality = static_cast<int>(jpeg_quality::very_high);
 
+        // zlib level, from 0 (store) to 9 (smallest)
+        int png_compression_level = 3;
+
+        // Threads deflating png stripes at once, 0 for every worker pool thread
+        size_t png_thread_count = 0;
+
+        png_filter_selection png_filter_choice = png_filter_selection::sampled;
+        png_filter png_fixed_filter = png_filter::paeth;
+
         constexpr image_save_options() {}
     };
 
@@ -45,9 +83,13 @@ namespace xsteg
         int _channels = 0;
         bool _loaded_stbi = false;
 
+        // File holding the pixels in place, for RGBA pam images
+        std::unique_ptr<mapped_file> _mapping;
+
     public:
         image(int width, int height);
         image(const std::string& fname);
+        image(const uint8_t* encoded_data, size_t len);
         ~image();
 
         image(const image& cp_src) = delete;
@@ -62,8 +104,14 @@ namespace xsteg
         image create_resized_copy_proportional(float percentage_w, float percentage_h);
 
         void read_from_file(const std::string& fname);
+        void read_from_memory(const uint8_t* encoded_data, size_t len);
         void write_to_file(const std::string& fname, image_save_options opt = image_save_options());
 
+        // Encodes the image as write_to_file would, into memory
+        std::vector<uint8_t> write_to_memory(image_save_options opt = image_save_options()) const;
+
+        // RGBA pixels. For pam images these point into a copy-on-write mapping
+        // of the file: changes stay in memory.
         const uint8_t* cdata() const;
         uint8_t* data();
 
@@ -80,7 +128,23 @@ namespace xsteg
             size_t max_truncated_bits = std::numeric_limits<size_t>::max());
 
     private:
-        void write_to_file_png(const std::string& fname);
+        bool read_striped_png(const uint8_t* encoded_data, size_t len);
+
+        // Takes over 'mapping' (which holds 'encoded_data') as the pixel buffer when
+        // the pam image is RGBA already, otherwise the pixels are converted
+        bool read_pam(const uint8_t* encoded_data, size_t len, std::unique_ptr<mapped_file>& mapping);
+
+        // Copies the pixels out of the mapped file, so it can be written over
+        void detach_mapping();
+
+        void write_to_file_png(const std::string& fname, const image_save_options& opt);
         void write_to_file_jpeg(const std::string& fname, int quality);
+        void write_to_file_uncompressed(const std::string& fname, image_format format);
+
+        // Header of the pam, bmp or tga file, empty if the image is too large for it
+        std::vector<uint8_t> uncompressed_header(image_format format) const;
+
+        // Pixels as the pam, bmp or tga file stores them, copied in parallel
+        void store_uncompressed_pixels(image_format format, uint8_t* dst) const;
     };
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <xsteg/image.hpp>
+
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace xsteg
+{
+    struct png_chunk;
+
+    /*
+     * Decodes an image row by row, as RGBA, with the same pixel values as
+     * image::read_from_file. Non-interlaced PNGs are inflated and unfiltered
+     * incrementally, so only the rows being handed out are held in memory.
+     * Any other image is decoded as a whole first and then handed out in rows.
+     *
+     * The input is only ever read forward, so it can also be a pipe. Rows are
+     * decoded on demand: whatever follows the last row read is never inflated.
+     */
+    class image_reader
+    {
+    public:
+        // Pixels handed out per batch by default (see batch_rows)
+        static constexpr size_t BATCH_PX = 1 << 18;
+
+    private:
+        struct png_stream;
+
+        std::string _fname;
+        std::FILE* _file = nullptr;
+        bool _owns_file = false;
+        bool _keep_header = false;
+        std::vector<uint8_t> _header_bytes;
+        std::unique_ptr<png_stream> _png;
+        std::unique_ptr<image> _decoded;
+        int _width = 0;
+        int _height = 0;
+        int _rows_read = 0;
+
+    public:
+        explicit image_reader(const std::string& fname);
+
+        // Reads from an already open file or pipe (e.g. stdin), which is not closed
+        explicit image_reader(std::FILE* stream);
+        ~image_reader();
+
+        image_reader(const image_reader&) = delete;
+        image_reader& operator=(const image_reader&) = delete;
+
+        int width() const;
+        int height() const;
+        size_t pixel_count() const;
+
+        int rows_read() const;
+
+        // Rows holding about BATCH_PX pixels, at least one
+        int batch_rows() const;
+
+        // False when the whole image had to be decoded up front
+        bool is_streaming() const;
+
+        // Decodes up to 'max_rows' of the following rows into 'dst', which must hold
+        // max_rows * width() * 4 bytes. Returns the rows decoded, 0 once the image ends.
+        int read_rows(uint8_t* dst, int max_rows);
+
+    private:
+        void open();
+        bool open_png();
+        void close();
+        [[noreturn]] void throw_corrupt(const char* reason) const;
+
+        // Takes the next 'len' bytes of the file, skips them when 'dst' is null.
+        // False past the end of the file.
+        bool read_bytes(uint8_t* dst, size_t len);
+
+        // Take data of the current chunk, or the next chunk, throwing past the end of the file
+        void read_exact(void* dst, size_t len);
+        void next_chunk(png_chunk& chunk);
+        size_t read_idat(uint8_t* dst, size_t len);
+        void inflate_row();
+        void unfilter_row();
+        void convert_row(uint8_t* dst) const;
+    };
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <xsteg/image.hpp>
+
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace xsteg
+{
+    /*
+     * Encodes an RGBA png image row by row, so it never has to be held whole.
+     * Row filters are picked as image_save_options tells (see png_filter.hpp).
+     *
+     * Rows are split into stripes that are filtered and deflated in parallel,
+     * each as an independent raw deflate stream in its own IDAT chunk. Every
+     * stripe but the last ends on a sync flush, so the stripes join into a
+     * single zlib stream, and they are listed after the image data so they
+     * can be inflated in parallel as well (see png_stripes.hpp).
+     *
+     * The same layout lets an image read from such a png be saved by copying
+     * most of its compressed data as is (see patch_rows).
+     */
+    class image_writer
+    {
+    public:
+        // Uncompressed bytes per stripe, in whole rows
+        static constexpr size_t STRIPE_BYTES = 1 << 17;
+
+    private:
+        struct stripe;
+
+        std::string _fname;
+        std::FILE* _file = nullptr;
+
+        // Destination of the encoded image instead of a file, when set
+        std::vector<uint8_t>* _buffer = nullptr;
+        bool _finished = false;
+
+        int _width = 0;
+        int _height = 0;
+        int _rows_written = 0;
+        int _compression_level = 3;
+        size_t _thread_count = 0;
+        png_filter_selection _filter_selection = png_filter_selection::sampled;
+        png_filter _fixed_filter = png_filter::paeth;
+
+        std::vector<uint8_t> _prev_row;
+        uint32_t _adler = 1;
+
+        // Filtered bytes of every IDAT chunk, listed after the image data while
+        // every chunk decodes on its own (see png_stripes.hpp)
+        std::vector<uint32_t> _stripe_lengths;
+        bool _striped = true;
+
+    public:
+        image_writer(
+            const std::string& fname,
+            int width,
+            int height,
+            image_save_options opt = image_save_options());
+
+        // Encodes into 'dst', replacing its contents. It is left empty unless
+        // the image is completed.
+        image_writer(
+            std::vector<uint8_t>& dst,
+            int width,
+            int height,
+            image_save_options opt = image_save_options());
+
+        ~image_writer();
+
+        image_writer(const image_writer&) = delete;
+        image_writer& operator=(const image_writer&) = delete;
+
+        int rows_written() const;
+
+        // Encodes the following 'row_count' rows of width * 4 bytes each.
+        // The file is completed once the last row is written.
+        void write_rows(const uint8_t* src, int row_count);
+
+        // Writes the whole image 'pixels' from 'source_fname', the png file it was read
+        // from, where only rows in [dirty_begin, dirty_end) have changed since. Stripes
+        // that still decode to the same bytes are copied, the rest are compressed again.
+        // Returns false, with no rows written, if the source is not laid out in stripes
+        // as image_writer writes them or most rows changed; use write_rows then.
+        bool patch_rows(
+            const std::string& source_fname,
+            const uint8_t* pixels,
+            int dirty_begin,
+            int dirty_end);
+
+    private:
+        void start();
+        size_t stripes_per_round() const;
+        void encode_stripe(stripe& st, const uint8_t* src, const uint8_t* prev_row) const;
+        void write_stripes(std::vector<stripe>& stripes);
+        void finish();
+        void write_chunk(const char* type, const uint8_t* data, size_t len);
+        void write_bytes(const void* src, size_t len);
+    };
+}
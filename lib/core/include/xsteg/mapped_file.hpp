@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace xsteg
+{
+    /*
+     * File mapped into memory. Existing files are mapped copy-on-write, so
+     * their contents can be changed in memory without touching the file.
+     */
+    class mapped_file
+    {
+    private:
+        std::string _fname;
+        uint8_t* _data = nullptr;
+        size_t _size = 0;
+
+        // File descriptor, or the file and mapping handles on Windows
+        intptr_t _file = -1;
+        void* _mapping = nullptr;
+
+        mapped_file() = default;
+
+    public:
+        ~mapped_file();
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        // Maps an existing file, nullptr if it can not be opened
+        static std::unique_ptr<mapped_file> open(const std::string& fname);
+
+        // Creates a file of 'size' bytes, replacing any other, and maps it for
+        // writing. Its blocks are allocated up front, so a full disk shows here:
+        // nullptr, with no file left, if it can not be created.
+        static std::unique_ptr<mapped_file> create(const std::string& fname, size_t size);
+
+        const std::string& fname() const;
+        uint8_t* data();
+        size_t size() const;
+    };
+}
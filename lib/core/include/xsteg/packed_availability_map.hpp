@@ -0,0 +1,83 @@
+#pragma once
+
+#include <xsteg/pixel_availability.hpp>
+
+#include <array>
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+namespace xsteg
+{
+    /*
+     * Per-pixel availability packed as one nibble per channel (r, g, b, a
+     * from high to low), where 0xF keeps the 'unset' (-1) state. When every
+     * reachable availability fits in a palette of 256 entries, pixels only
+     * store a one byte palette index.
+     */
+    class packed_availability_map
+    {
+    public:
+        static constexpr uint16_t UNSET_WORD = 0xFFFFu;
+        static constexpr size_t MAX_PALETTE_SIZE = 256;
+
+    private:
+        size_t _size = 0;
+        std::vector<uint8_t> _indices;
+        std::vector<uint16_t> _words;
+        std::vector<uint16_t> _palette;
+        std::vector<uint32_t> _palette_masks;
+        std::vector<uint8_t> _palette_lookup;
+
+        static const std::array<uint16_t, 256> _nibble_pair_masks;
+
+    public:
+        packed_availability_map() = default;
+
+        // An empty palette selects 2 bytes per pixel storage.
+        // Every pixel starts as the first palette entry (or as unset).
+        void reset(size_t pixel_count, std::vector<uint16_t> palette);
+
+        size_t size() const;
+        bool uses_palette() const;
+        const std::vector<uint16_t>& palette() const;
+
+        uint8_t* palette_index_data();
+        const uint8_t* palette_index_data() const;
+        uint16_t* word_data();
+        const uint16_t* word_data() const;
+
+        inline uint16_t word_at(size_t px) const
+        {
+            return _palette.empty() ? _words[px] : _palette[_indices[px]];
+        }
+
+        inline uint32_t mask_at(size_t px) const
+        {
+            return _palette.empty() ? word_mask(_words[px]) : _palette_masks[_indices[px]];
+        }
+
+        // The word must be in the palette when one is used
+        inline void set_word(size_t px, uint16_t word)
+        {
+            if(_palette.empty())
+                { _words[px] = word; }
+            else
+                { _indices[px] = _palette_lookup[word]; }
+        }
+
+        inline pixel_availability operator[](size_t px) const
+        {
+            return unpack(word_at(px));
+        }
+
+        static inline uint32_t word_mask(uint16_t word)
+        {
+            return (static_cast<uint32_t>(_nibble_pair_masks[word >> 8]) << 16)
+                 | _nibble_pair_masks[word & 0xFFu];
+        }
+
+        static uint16_t pack(const pixel_availability& av);
+        static pixel_availability unpack(uint16_t word);
+    };
+}
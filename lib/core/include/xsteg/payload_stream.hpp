@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+namespace xsteg
+{
+    class steganographer;
+
+    /*
+     * Embeds a payload into the carrier of a steganographer chunk by chunk, as
+     * it arrives, so it never has to be held whole. The size header goes in
+     * front of the data once its length is known, on finish.
+     *
+     * Only for carriers loaded whole, streamed ones are embedded while saving.
+     *
+     * The carrier bits written over are only kept for steganographer::reset
+     * when asked for, since they take as much memory as the payload. Without
+     * them the carrier can not be reset once the payload grows past what was
+     * written before.
+     */
+    class stream_encoder
+    {
+    private:
+        steganographer& _steg;
+        size_t _size = 0;
+        bool _finished = false;
+        bool _undoable = false;
+
+    public:
+        explicit stream_encoder(steganographer& steg, bool undoable = false);
+
+        // Embeds the next 'len' bytes of the payload. Throws, leaving the data
+        // incomplete, if they do not fit (see steganographer::reset).
+        void write(const uint8_t* data, size_t len);
+
+        // Writes the size header, after which the payload can be read back.
+        // Nothing can be written afterwards.
+        void finish();
+
+        // Payload bytes written so far
+        size_t size() const;
+    };
+
+    /*
+     * Extracts the payload embedded in the carrier of a steganographer chunk
+     * by chunk, into buffers of any size. Only for carriers loaded whole.
+     */
+    class stream_decoder
+    {
+    private:
+        steganographer& _steg;
+        size_t _size = 0;
+        size_t _position = 0;
+
+    public:
+        // Reads the size header, throws if it does not match the thresholds
+        explicit stream_decoder(steganographer& steg);
+
+        // Copies up to 'len' bytes of the payload into 'dst', returns how many.
+        // Zero once the whole payload has been read.
+        size_t read(uint8_t* dst, size_t len);
+
+        // Payload size and bytes read so far
+        size_t size() const;
+        size_t position() const;
+    };
+}
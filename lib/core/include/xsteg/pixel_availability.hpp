@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cinttypes>
+
 namespace xsteg
 {
     struct pixel_availability
@@ -27,5 +29,20 @@ namespace xsteg
         {
             return r == -1 && g == -1 && b == -1 && a == -1;
         }
+
+        // Embed mask in pixel word layout (see pixel_bits.hpp)
+        constexpr uint32_t embed_mask() const
+        {
+            return (channel_mask(r) << 24)
+                 | (channel_mask(g) << 16)
+                 | (channel_mask(b) << 8)
+                 | (channel_mask(a));
+        }
+
+    private:
+        static constexpr uint32_t channel_mask(int bits)
+        {
+            return (bits <= 0) ? 0u : ((1u << bits) - 1u);
+        }
     };
 }
\ No newline at end of file
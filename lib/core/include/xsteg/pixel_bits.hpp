@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+#if defined(__BMI2__) || (defined(_MSC_VER) && defined(__AVX2__))
+    #define XSTEG_HAS_BMI2 1
+    #include <immintrin.h>
+#else
+    #define XSTEG_HAS_BMI2 0
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+    #include <intrin.h>
+#endif
+
+namespace xsteg
+{
+    /*
+     * Pixels are handled as 32-bit words with the red channel in the most
+     * significant byte (R, G, B, A from high to low). Embed masks use the
+     * same layout, so the data bit order (red first, most significant bit
+     * of each channel first) matches descending mask bit positions.
+     */
+
+    inline uint32_t load_pixel_word(const uint8_t* px)
+    {
+        return (static_cast<uint32_t>(px[0]) << 24)
+             | (static_cast<uint32_t>(px[1]) << 16)
+             | (static_cast<uint32_t>(px[2]) << 8)
+             | (static_cast<uint32_t>(px[3]));
+    }
+
+    inline void store_pixel_word(uint8_t* px, uint32_t word)
+    {
+        px[0] = static_cast<uint8_t>(word >> 24);
+        px[1] = static_cast<uint8_t>(word >> 16);
+        px[2] = static_cast<uint8_t>(word >> 8);
+        px[3] = static_cast<uint8_t>(word);
+    }
+
+    inline size_t popcount32(uint32_t val)
+    {
+    #if defined(__GNUC__) || defined(__clang__)
+        return static_cast<size_t>(__builtin_popcount(val));
+    #elif defined(_MSC_VER) && defined(__AVX2__)
+        return static_cast<size_t>(__popcnt(val));
+    #else
+        val = val - ((val >> 1) & 0x55555555u);
+        val = (val & 0x33333333u) + ((val >> 2) & 0x33333333u);
+        return static_cast<size_t>((((val + (val >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+    #endif
+    }
+
+    // Scatters the lowest popcount(mask) bits of 'bits' into the set bits of 'mask'.
+    // The portable path relies on the mask covering only the lowest bits of each channel.
+    inline uint32_t deposit_pixel_bits(uint32_t bits, uint32_t mask)
+    {
+    #if XSTEG_HAS_BMI2
+        return _pdep_u32(bits, mask);
+    #else
+        uint32_t result = 0;
+        for(uint32_t shift = 0; shift < 32; shift += 8)
+        {
+            uint32_t ch_mask = (mask >> shift) & 0xFFu;
+            result |= (bits & ch_mask) << shift;
+            bits >>= popcount32(ch_mask);
+        }
+        return result;
+    #endif
+    }
+
+    // Gathers the bits of 'word' selected by 'mask' into the lowest bits of the result
+    inline uint32_t extract_pixel_bits(uint32_t word, uint32_t mask)
+    {
+    #if XSTEG_HAS_BMI2
+        return _pext_u32(word, mask);
+    #else
+        uint32_t result = 0;
+        for(int shift = 24; shift >= 0; shift -= 8)
+        {
+            uint32_t ch_mask = (mask >> shift) & 0xFFu;
+            result = (result << popcount32(ch_mask)) | ((word >> shift) & ch_mask);
+        }
+        return result;
+    #endif
+    }
+}
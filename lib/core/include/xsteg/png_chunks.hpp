@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+namespace xsteg
+{
+    static constexpr uint8_t PNG_SIGNATURE[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+    // Largest width or height decoded, as with stb_image
+    static constexpr uint32_t PNG_MAX_DIMENSION = 1u << 24;
+
+    inline uint32_t load_be32(const uint8_t* ptr)
+    {
+        return (static_cast<uint32_t>(ptr[0]) << 24)
+             | (static_cast<uint32_t>(ptr[1]) << 16)
+             | (static_cast<uint32_t>(ptr[2]) << 8)
+             | (static_cast<uint32_t>(ptr[3]));
+    }
+
+    inline uint16_t load_be16(const uint8_t* ptr)
+    {
+        return static_cast<uint16_t>((ptr[0] << 8) | ptr[1]);
+    }
+
+    inline void store_be32(uint8_t* ptr, uint32_t val)
+    {
+        ptr[0] = static_cast<uint8_t>(val >> 24);
+        ptr[1] = static_cast<uint8_t>(val >> 16);
+        ptr[2] = static_cast<uint8_t>(val >> 8);
+        ptr[3] = static_cast<uint8_t>(val);
+    }
+
+    struct png_chunk
+    {
+        char type[5] = { };
+        uint32_t length = 0;
+
+        // Offset of the chunk data from the start of the file
+        size_t offset = 0;
+
+        bool is(const char* chunk_type) const
+        {
+            return std::memcmp(type, chunk_type, 4) == 0;
+        }
+    };
+
+    /*
+     * Walks the chunks of a png in file order. Bytes are taken through a
+     * function, so the same walk serves files, pipes and memory.
+     */
+    class png_chunk_iterator
+    {
+    public:
+        // Takes the next 'len' bytes into 'dst', or skips them when 'dst' is null.
+        // False past the end of the file.
+        using read_func = std::function<bool(uint8_t* dst, size_t len)>;
+
+    private:
+        read_func _read;
+        const uint8_t* _data = nullptr;
+        size_t _size = SIZE_MAX;
+        size_t _pos = 0;
+
+        // Data and CRC bytes of the current chunk not taken yet
+        size_t _chunk_left = 0;
+
+    public:
+        // 'size' bounds the chunks when the size of the file is known
+        explicit png_chunk_iterator(read_func read, size_t size = SIZE_MAX);
+
+        // Over a png held in memory, which must outlive this
+        png_chunk_iterator(const uint8_t* data, size_t len);
+
+        // Takes the signature, false for anything but a png
+        bool read_signature();
+
+        // Skips what is left of the current chunk, then takes the header of the
+        // next one. False at the end of the file or for a chunk running past it.
+        bool next(png_chunk& chunk);
+
+        // Takes the next 'len' data bytes of the current chunk, see read_func
+        bool read_data(uint8_t* dst, size_t len);
+    };
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <xsteg/image.hpp>
+
+#include <cinttypes>
+#include <cstddef>
+
+namespace xsteg
+{
+    /*
+     * Png scanline filters. Rows of 4 byte pixels (8 bit RGBA) are filtered
+     * and unfiltered 16 bytes at a time with SSE2 when available, other
+     * pixel sizes fall back to scalar loops. 'prev' is the unfiltered
+     * previous row, all zeros for the first one.
+     */
+
+    // Filters 'len' bytes of 'row' (4 bytes per pixel) into 'dst'
+    void png_filter_row(
+        png_filter filter, 
+        const uint8_t* row, 
+        const uint8_t* prev, 
+        size_t len, 
+        uint8_t* dst);
+
+    // Filter of a row (4 bytes per pixel), picked as 'selection' tells
+    png_filter png_select_filter(
+        png_filter_selection selection,
+        png_filter fixed_filter,
+        const uint8_t* row,
+        const uint8_t* prev,
+        size_t len);
+
+    // Restores 'len' bytes of a row of 'bpp' bytes per pixel, in place.
+    // Returns false for an unknown filter type.
+    bool png_unfilter_row(
+        uint8_t filter_type, 
+        uint8_t* row, 
+        const uint8_t* prev, 
+        size_t len, 
+        size_t bpp);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+namespace xsteg
+{
+    /*
+     * Pngs written by image_writer hold one deflate stripe per IDAT chunk,
+     * each decodable without the data before it. A private ancillary chunk
+     * after the image data lists the filtered bytes held by every stripe, so
+     * they can be inflated concurrently. Other decoders skip the chunk.
+     */
+    static constexpr char PNG_STRIPES_CHUNK[5] = "xsST";
+
+    // Payload of the stripes chunk: the filtered byte count of every stripe
+    std::vector<uint8_t> encode_png_stripes(const std::vector<uint32_t>& filtered_lengths);
+    bool decode_png_stripes(const uint8_t* payload, size_t len, std::vector<uint32_t>& filtered_lengths);
+
+    // Inflates a stripe, which must hold exactly 'dst_len' filtered bytes. The first
+    // stripe starts with the zlib header, the last one ends the stream.
+    bool inflate_png_stripe(
+        const uint8_t* src,
+        size_t len,
+        bool first,
+        bool last,
+        uint8_t* dst,
+        size_t dst_len);
+
+    class striped_png
+    {
+    private:
+        struct stripe
+        {
+            const uint8_t* data = nullptr;
+            size_t len = 0;
+            size_t filtered_offset = 0;
+            size_t filtered_len = 0;
+        };
+
+        std::vector<stripe> _stripes;
+        int _width = 0;
+        int _height = 0;
+
+    public:
+        // Finds the stripes of the encoded image in 'data', which must outlive this
+        striped_png(const uint8_t* data, size_t len);
+
+        // False for anything but an RGBA png listing its stripes
+        bool is_striped() const;
+
+        int width() const;
+        int height() const;
+
+        // Decodes the pixels into 'dst' (width * height * 4 bytes). Stripes are
+        // inflated in parallel, then unfiltered in order. False if corrupt.
+        bool decode(uint8_t* dst) const;
+    };
+}
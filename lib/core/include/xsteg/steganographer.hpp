@@ -4,19 +4,73 @@
 #include <xsteg/image.hpp>
 #include <xsteg/visual_data.hpp>
 
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace xsteg
 {
+    class image_reader;
+    class image_writer;
+
+    enum class carrier_loading
+    {
+        // Decoded once and held in memory
+        whole,
+        // Decoded row by row on every pass (see image_reader), encoded images
+        // are written row by row as well
+        streamed
+    };
+
     class steganographer
     {
+        friend class stream_encoder;
+        friend class stream_decoder;
+
     private:
+        std::string _fname;
+        carrier_loading _loading = carrier_loading::whole;
         std::unique_ptr<image> _img;
         std::unique_ptr<availability_map> _av_map;
 
+        // Reader for the next streamed pass, when already open
+        std::unique_ptr<image_reader> _reader;
+
+        // Header and data waiting to be embedded by save_to_file, when streamed
+        std::vector<uint8_t> _pending_data;
+
+        // Pixels changed by write_data, and the carrier file as it was loaded,
+        // so saving can reuse the compressed data of the unchanged rows
+        size_t _changed_px_begin = SIZE_MAX;
+        size_t _changed_px_end = 0;
+        std::filesystem::file_time_type _source_time;
+        std::uintmax_t _source_size = 0;
+
+        // Carrier bits as they were before the first write_data, up to the
+        // furthest bit written since, so reset can restore them. Lost for good
+        // once bits past the log are written without it (see stream_encoder).
+        std::vector<uint8_t> _undo_log;
+        size_t _undo_bits = 0;
+        bool _undo_lost = false;
+
     public:
-        explicit steganographer(const std::string& fname);
+        explicit steganographer(
+            const std::string& fname, 
+            carrier_loading loading = carrier_loading::whole);
+
+        // Decoded from an encoded image in memory, held whole
+        steganographer(const uint8_t* encoded_data, size_t len);
+
+        // Takes over an image already decoded
+        explicit steganographer(image&& img);
+
+        // Streamed from an open file or pipe (e.g. stdin), which is only read
+        // once: a single read or space query, or a single write and save.
+        explicit steganographer(std::FILE* stream);
+        ~steganographer();
 
         void add_threshold(
             visual_data_type type, 
@@ -28,13 +82,74 @@ namespace xsteg
         void restore_key(const std::string& key);
 
         void write_data(uint8_t* data, size_t len);
+
+        // Restores the carrier as it was loaded, undoing every write_data since,
+        // in time proportional to the bits written. Thresholds and the
+        // availability map are kept, so other data can be written right away.
+        // Throws std::logic_error once a stream_encoder without an undo log has
+        // written past the bits already logged.
+        void reset();
         std::vector<uint8_t> read_data();
+
+        // Data can also be written and read in chunks, see payload_stream.hpp
+
+        // Size in bytes of the encoded data
+        size_t read_data_size();
+
+        // Extracts only 'length' bytes starting at byte 'offset' of the encoded data.
+        // The range is clipped to the end of the data.
+        std::vector<uint8_t> read_data_range(size_t offset, size_t length);
         
-        void save_to_file(const std::string& fname);
+        // Encoded images are png, or one of the uncompressed formats when
+        // asked for and the carrier is not streamed. Jpeg is never used.
+        // A carrier png written by xsteg is only compressed again around the
+        // rows that changed (see image_writer::patch_rows). Streamed carriers
+        // can not be saved over the file they are read from.
+        void save_to_file(const std::string& fname, image_save_options opt = image_save_options());
+
+        // Encodes the image as save_to_file would, into memory. Every row is
+        // compressed again.
+        std::vector<uint8_t> save_to_memory(image_save_options opt = image_save_options());
 
         size_t available_space_bits();
 
     private:
-        size_t decode_size_header(size_t& skipped_px);
+        image_save_options carrier_save_options(image_save_options opt) const;
+        bool can_patch_source(const std::string& fname) const;
+        size_t decode_size_header();
+        void require_encoded_bits(size_t bit_len);
+
+        void write_size_header(size_t bit_len, bool log_undo = true);
+
+        // Writes data bits [first_bit, first_bit + bit_count), held by 'data', after
+        // checking they fit and, if 'log_undo', saving the carrier bits they replace for reset
+        void write_bits(const uint8_t* data, size_t first_bit, size_t bit_count, bool log_undo = true);
+
+        // Embeds the bits as write_bits, without any checks, in parallel
+        void embed_bits(const uint8_t* data, size_t first_bit, size_t bit_count);
+
+        void embed_runs(
+            const uint8_t* data, 
+            size_t first_bit, 
+            size_t end_bit, 
+            size_t first_run, 
+            size_t last_run);
+
+        void extract_bits(size_t first_bit, size_t bit_count, uint8_t* dst);
+
+        // Extracts 'length' payload bytes from byte 'offset' on, in parallel
+        void extract_payload(size_t offset, size_t length, uint8_t* dst);
+
+        // Extracts 'length' bytes of data bits from 'first_bit' on, in parallel
+        void extract_bytes(size_t first_bit, size_t length, uint8_t* dst);
+
+        // Returns the reader opened by the constructor, or a new one on the file;
+        // throws for a stream already read
+        std::unique_ptr<image_reader> open_reader();
+
+        // Reads the header, then 'length' bytes at 'offset' into 'dst' (if any).
+        // Returns the size of the encoded data.
+        size_t stream_read(size_t offset, size_t length, std::vector<uint8_t>* dst);
+        void stream_save(image_reader& reader, image_writer& writer);
     };
 }
\ No newline at end of file
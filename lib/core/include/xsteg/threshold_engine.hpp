@@ -0,0 +1,104 @@
+#pragma once
+
+#include <xsteg/availability_map.hpp>
+#include <xsteg/pixel_availability.hpp>
+#include <xsteg/visual_data.hpp>
+
+#include <array>
+#include <cinttypes>
+#include <vector>
+
+namespace xsteg
+{
+    // Channels a threshold overrides, as packed availability word operations
+    struct threshold_word_ops
+    {
+        uint16_t keep = 0xFFFFu;
+        uint16_t set = 0;
+
+        threshold_word_ops(const pixel_availability& bits);
+
+        uint16_t apply(uint16_t word) const
+        {
+            return static_cast<uint16_t>((word & keep) | set);
+        }
+    };
+
+    // Keys in [from, to) pass a threshold
+    struct threshold_cut
+    {
+        uint16_t from = 0;
+        uint16_t to = 0;
+    };
+
+    /*
+     * Evaluates every threshold of a pixel in a single pass, without visual
+     * data maps. Later thresholds override earlier ones, so they are checked
+     * from the last to the first, and a pixel is done as soon as all of its
+     * channels have been decided.
+     *
+     * Visual data grows with its integer key (see visual_data_key), so each
+     * threshold is turned once into a range of keys and pixels are compared
+     * in the integer domain only, with the same results as the float values.
+     *
+     * Thresholds on a single channel type only depend on one byte of the
+     * pixel, so they are decided by 256 entry tables instead. When every
+     * threshold is one of those and at most two channels are involved, the
+     * whole availability word is read from a single table.
+     */
+    class threshold_engine
+    {
+    private:
+        struct compiled_threshold
+        {
+            size_t vdata_slot = 0;
+            bool by_table = false;
+            std::vector<threshold_cut> cuts;
+            uint16_t channels = 0;
+            uint16_t set = 0;
+        };
+
+        struct vdata_slot
+        {
+            visual_data_type type = visual_data_type::COLOR_RED;
+            uint8_t truncate_masks[4] = { };
+        };
+
+        std::vector<compiled_threshold> _reversed;
+        std::vector<vdata_slot> _slots;
+
+        // Bit i is set when the byte passes the i-th reversed threshold
+        std::array<std::array<uint32_t, 256>, 4> _channel_passes = { };
+        bool _use_channel_passes = false;
+
+        // Availability word by the byte of one channel, or of two channels
+        std::vector<uint16_t> _word_table;
+        size_t _table_channels[2] = { };
+
+        // Bit i is set when thresholds not decided by table read the keys of slot i
+        uint32_t _keyed_slots = 0;
+
+    public:
+        threshold_engine(const std::vector<availability_threshold>& thresholds);
+
+        // Packed availability word of the pixel (see packed_availability_map)
+        uint16_t evaluate(const uint8_t* px) const;
+
+        // Availability words of 'count' pixels. Keys are computed for blocks of
+        // pixels at once (see get_visual_data_keys) instead of pixel by pixel.
+        void evaluate_span(const uint8_t* px, size_t count, uint16_t* words) const;
+
+        // Availability word of any pixel with the given key, when every
+        // threshold has the same visual data type
+        uint16_t evaluate_key(visual_data_key key) const;
+
+        // One cut per key row
+        static std::vector<threshold_cut> make_cuts(const availability_threshold& thres);
+
+    private:
+        void build_tables();
+        // 'key_of(slot)' gives the visual data key of the pixel for a slot
+        template<typename KeyOf>
+        uint16_t evaluate_thresholds(const uint8_t* px, const KeyOf& key_of) const;
+    };
+}
@@ -2,6 +2,9 @@
 
 #include <xsteg/image.hpp>
 #include <xsteg/pixel_availability.hpp>
+
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 namespace xsteg
@@ -20,6 +23,134 @@ namespace xsteg
         AVERAGE_VALUE_RGB
     };
 
+    // Clears the lowest 'bits' bits of a channel (none when unset)
+    inline uint8_t truncation_mask(int bits)
+    {
+        return static_cast<uint8_t>(0xFFu << std::max(bits, 0));
+    }
+
+    /*
+     * Every visual data type derives from an integer key: a channel value, the
+     * sum of the channels for the averages, max + min for LUMINANCE and
+     * max - min for SATURATION. SATURATION also divides by the max channel,
+     * which is kept as the key 'row'; every other type has a single row.
+     */
+    struct visual_data_key
+    {
+        uint16_t key = 0;
+        uint8_t row = 0;
+    };
+
+    inline visual_data_key get_visual_data_key(const uint8_t* tpx, visual_data_type type)
+    {
+        switch (type)
+        {
+            case visual_data_type::AVERAGE_VALUE_RGB:
+            {
+                return { static_cast<uint16_t>(tpx[0] + tpx[1] + tpx[2]), 0 };
+            }
+            case visual_data_type::AVERAGE_VALUE_RGBA:
+            {
+                return { static_cast<uint16_t>(tpx[0] + tpx[1] + tpx[2] + tpx[3]), 0 };
+            }
+            case visual_data_type::ALPHA:       { return { tpx[3], 0 }; }
+            case visual_data_type::COLOR_BLUE:  { return { tpx[2], 0 }; }
+            case visual_data_type::COLOR_GREEN: { return { tpx[1], 0 }; }
+            case visual_data_type::COLOR_RED:   { return { tpx[0], 0 }; }
+            case visual_data_type::LUMINANCE:
+            {
+                uint8_t max_rgb = std::max({ tpx[0], tpx[1], tpx[2] });
+                uint8_t min_rgb = std::min({ tpx[0], tpx[1], tpx[2] });
+                return { static_cast<uint16_t>(max_rgb + min_rgb), 0 };
+            }
+            case visual_data_type::SATURATION:
+            {
+                uint8_t max_rgb = std::max({ tpx[0], tpx[1], tpx[2] });
+                uint8_t min_rgb = std::min({ tpx[0], tpx[1], tpx[2] });
+                return { static_cast<uint16_t>(max_rgb - min_rgb), max_rgb };
+            }
+            default: return { };
+        }
+    }
+
+    // Pixel byte a single channel type reads, or -1 for the other types
+    inline int visual_data_channel(visual_data_type type)
+    {
+        switch (type)
+        {
+            case visual_data_type::COLOR_RED:   return 0;
+            case visual_data_type::COLOR_GREEN: return 1;
+            case visual_data_type::COLOR_BLUE:  return 2;
+            case visual_data_type::ALPHA:       return 3;
+            default:                            return -1;
+        }
+    }
+
+    // Number of distinct keys (per row) of a visual data type
+    inline size_t visual_data_key_count(visual_data_type type)
+    {
+        switch (type)
+        {
+            case visual_data_type::AVERAGE_VALUE_RGB:  return 3 * 255 + 1;
+            case visual_data_type::AVERAGE_VALUE_RGBA: return 4 * 255 + 1;
+            case visual_data_type::LUMINANCE:          return 2 * 255 + 1;
+            default:                                   return 256;
+        }
+    }
+
+    inline size_t visual_data_row_count(visual_data_type type)
+    {
+        return (type == visual_data_type::SATURATION) ? 256 : 1;
+    }
+
+    inline float get_visual_data_from_key(visual_data_key key, visual_data_type type)
+    {
+        switch (type)
+        {
+            case visual_data_type::AVERAGE_VALUE_RGB:
+            {
+                return static_cast<float>(key.key) / 3.0F / 255.0F;
+            }
+            case visual_data_type::AVERAGE_VALUE_RGBA:
+            {
+                return static_cast<float>(key.key) / 4.0F / 255.0F;
+            }
+            case visual_data_type::ALPHA:
+            case visual_data_type::COLOR_BLUE:
+            case visual_data_type::COLOR_GREEN:
+            case visual_data_type::COLOR_RED:
+            {
+                return static_cast<float>(key.key) / 255.0F;
+            }
+            case visual_data_type::LUMINANCE:
+            {
+                return std::abs((0.5F * key.key) / 255.0F);
+            }
+            case visual_data_type::SATURATION:
+            {
+                return static_cast<float>(key.key) / key.row;
+            }
+            default: return 0;
+        }
+    }
+
+    // Visual data of a pixel whose channels are already truncated
+    inline float get_truncated_visual_data(const uint8_t* tpx, visual_data_type type)
+    {
+        return get_visual_data_from_key(get_visual_data_key(tpx, type), type);
+    }
+
+    // Keys of 'count' pixels, truncated with 'truncate_masks' (one per channel).
+    // 'rows' is only written for SATURATION, the only type with more than one.
+    // Computed 16 (SSE2) or 32 (AVX2) pixels at a time where available.
+    extern void get_visual_data_keys(
+        const uint8_t* px, 
+        size_t count, 
+        visual_data_type type, 
+        const uint8_t* truncate_masks,
+        uint16_t* keys,
+        uint8_t* rows);
+
     extern float get_visual_data(
         const uint8_t* px, 
         visual_data_type type,
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <xsteg/image.hpp>
+#include <xsteg/pixel_availability.hpp>
+#include <xsteg/visual_data.hpp>
+
+#include <cinttypes>
+#include <vector>
+
+namespace xsteg
+{
+    /*
+     * Pixel count of an image for every integer key (and key row) of a visual
+     * data type, see visual_data_key. Answers capacity questions for the type
+     * in O(bins) instead of O(pixels).
+     */
+    class visual_data_histogram
+    {
+    private:
+        visual_data_type _type = visual_data_type::COLOR_RED;
+        size_t _key_count = 0;
+        size_t _row_count = 0;
+        size_t _pixel_count = 0;
+        std::vector<uint64_t> _counts;
+
+    public:
+        visual_data_histogram(
+            const image* img, 
+            visual_data_type type, 
+            pixel_availability truncate_bits);
+
+        visual_data_type type() const;
+        size_t key_count() const;
+        size_t row_count() const;
+        size_t pixel_count() const;
+
+        inline uint64_t count(size_t row, size_t key) const
+        {
+            return _counts[(row * _key_count) + key];
+        }
+    };
+}
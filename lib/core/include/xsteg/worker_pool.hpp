@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace xsteg
+{
+    /*
+     * Fixed set of worker threads, started once and reused by every parallel
+     * section. The calling thread takes part in the work too, so a pool of N
+     * threads only starts N - 1 workers.
+     */
+    class worker_pool
+    {
+    public:
+        typedef std::function<void(size_t)> task_t;
+
+    private:
+        std::vector<std::thread> _workers;
+
+        std::mutex _submit_lock;
+        std::mutex _lock;
+        std::condition_variable _work_cv;
+        std::condition_variable _done_cv;
+
+        const task_t* _task = nullptr;
+        size_t _task_count = 0;
+        std::atomic<size_t> _next_task { 0 };
+        std::atomic<size_t> _pending_tasks { 0 };
+        size_t _active_workers = 0;
+        size_t _generation = 0;
+        bool _stopping = false;
+        std::exception_ptr _error;
+
+    public:
+        explicit worker_pool(size_t thread_count);
+        ~worker_pool();
+
+        worker_pool(const worker_pool&) = delete;
+        worker_pool& operator=(const worker_pool&) = delete;
+
+        // Workers plus the calling thread
+        size_t thread_count() const;
+
+        // Runs task(0) to task(task_count - 1) and returns once all of them are done.
+        // The first exception thrown by a task is rethrown here. Calls made from
+        // inside a task run serially on the calling thread.
+        void parallel_for(size_t task_count, const task_t& task);
+
+        // Pool sized to the hardware concurrency, started on first use
+        static worker_pool& shared();
+
+    private:
+        void worker_loop();
+        void run_tasks();
+    };
+}
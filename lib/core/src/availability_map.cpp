@@ -1,6 +1,11 @@
 #include <xsteg/availability_map.hpp>
 
+#include <xsteg/image_reader.hpp>
+#include <xsteg/pixel_bits.hpp>
 #include <xsteg/synced_print.hpp>
+#include <xsteg/threshold_engine.hpp>
+#include <xsteg/visual_data_histogram.hpp>
+#include <xsteg/worker_pool.hpp>
 
 #include <strutils/strutils.hpp>
 
@@ -10,6 +15,7 @@
 #include <map>
 #include <mutex>
 #include <sstream>
+#include <stdexcept>
 #include <thread>
 #include <numeric>
 
@@ -20,6 +26,14 @@ namespace xsteg
     static const char BITS_OV_DESIGNATOR = '*';
     static const char VALUE_DESIGNATOR = '+';
 
+    static const size_t RUN_MERGE_GAP_PX = 32;
+    static const size_t RUN_MAX_PX = 4096;
+
+    // Pixels evaluated at once by threshold_engine::evaluate_span, on the stack
+    static const size_t WORD_BLOCK_PX = 1024;
+    static const size_t LAZY_FIRST_CHUNK_PX = 1 << 16;
+    static const size_t MIN_SEGMENT_PX = 1 << 14;
+
     std::map<visual_data_type, char> type_designators = {
         { visual_data_type::ALPHA, '3' },
         { visual_data_type::AVERAGE_VALUE_RGB, 'V' },
@@ -150,9 +164,14 @@ namespace xsteg
     availability_map::availability_map(const image* imgptr)
     {
         _img = imgptr;
-        _map.resize(_img->pixel_count(), pixel_availability(-1, -1, -1, -1));
+        if(_img != nullptr)
+        {
+            _map.reset(_img->pixel_count(), { packed_availability_map::UNSET_WORD });
+        }
     }
 
+    availability_map::~availability_map() = default;
+
     void availability_map::add_threshold(
         visual_data_type type, 
         threshold_direction dir, 
@@ -183,11 +202,30 @@ namespace xsteg
             std::max(_max_threshold_bits.b, thresh.bits.b);
     }
 
-    const std::vector<pixel_availability>& availability_map::available_map() const
+    const packed_availability_map& availability_map::available_map() const
     {
         return _map;
     }
 
+    const std::vector<availability_run>& availability_map::available_runs() const
+    {
+        return _runs;
+    }
+
+    size_t availability_map::find_run(size_t bit_idx) const
+    {
+        auto it = std::upper_bound(_runs.begin(), _runs.end(), bit_idx, 
+            [](size_t bit, const availability_run& run)
+            {
+                return bit < run.bit_offset;
+            });
+
+        if(it == _runs.begin()) { return _runs.size(); }
+        --it;
+        if(bit_idx >= it->bit_offset + it->bit_count) { return _runs.size(); }
+        return static_cast<size_t>(std::distance(_runs.begin(), it));
+    }
+
     const image* availability_map::image_ptr() const
     {
         return _img;
@@ -195,137 +233,283 @@ namespace xsteg
 
     void availability_map::apply_thresholds()
     {
-        if(!_modified) { return; }
-        _modified = false;
+        reset_evaluation();
+        evaluate_until(_img->pixel_count());
+    }
 
-        static const unsigned int max_threads = std::thread::hardware_concurrency();
-        if((max_threads > 1))
+    size_t availability_map::ensure_data_space(size_t bits)
+    {
+        reset_evaluation();
+
+        const size_t pixel_count = _img->pixel_count();
+        const size_t row_px = static_cast<size_t>(_img->width());
+        while((evaluated_data_space() < bits) && (_evaluated_px < pixel_count))
         {
-            apply_thresholds_mt(max_threads);
+            // Whole rows, in chunks doubling in size to keep the overhead per chunk low
+            size_t chunk_px = ((_next_chunk_px + row_px - 1) / row_px) * row_px;
+            evaluate_until(std::min(pixel_count, _evaluated_px + chunk_px));
+            _next_chunk_px *= 2;
         }
-        else
+        return evaluated_data_space();
+    }
+
+    void availability_map::reset_evaluation()
+    {
+        if(_img == nullptr)
         {
-            apply_thresholds_st();
+            throw std::logic_error("Thresholds can only be applied to a loaded image");
         }
+        if(!_modified) { return; }
+        _modified = false;
+
+        reset_packed_map();
+        _engine = std::make_unique<threshold_engine>(_thresholds);
+        _runs.clear();
+        _run_open = false;
+        _run_gap_px = 0;
+        _evaluated_px = 0;
+        _next_chunk_px = LAZY_FIRST_CHUNK_PX;
     }
 
-    void availability_map::apply_thresholds_segment(
-        size_t from_px,
-        size_t to_px,
-        const _vdata_map_map_t& vdata_maps)
+    void availability_map::evaluate_until(size_t to_px)
     {
-        for(size_t thi = 0; thi < _thresholds.size(); ++thi)
+        if(to_px <= _evaluated_px) { return; }
+
+        const threshold_engine& engine = *_engine;
+        worker_pool& pool = worker_pool::shared();
+
+        const size_t from_px = _evaluated_px;
+        const size_t segment_count = std::clamp<size_t>(
+            (to_px - from_px) / MIN_SEGMENT_PX, 1, pool.thread_count());
+        const size_t segment_px = (to_px - from_px) / segment_count;
+
+        pool.parallel_for(segment_count, [&](size_t i)
         {
-            auto& thres = _thresholds[thi];
-            const size_t report_threshold_px = (size_t)400000 + std::abs(rand() % 100000l); // report progress every x pixels
-            const std::vector<float>& vdata = vdata_maps.at(thres.data_type);
-            for(size_t pxi = from_px; pxi < to_px; ++pxi)
-            {
-                float px_data_val = vdata[pxi];
-                bool cond = (thres.direction == threshold_direction::UP)
-                            ? px_data_val >= thres.value
-                            : px_data_val <= thres.value;
+            size_t segment_from = from_px + (i * segment_px);
+            size_t segment_to = (i == segment_count - 1) ? to_px : (segment_from + segment_px);
+            apply_thresholds_segment(segment_from, segment_to, engine);
+        });
+        build_runs(_evaluated_px, to_px);
+        _evaluated_px = to_px;
+    }
+
+    size_t availability_map::evaluated_data_space() const
+    {
+        if(_runs.empty()) { return 0; }
+        return _runs.back().bit_offset + _runs.back().bit_count;
+    }
 
-                if(cond)
+    void availability_map::build_runs(size_t from_px, size_t to_px)
+    {
+        // The last run stays open between calls, so it can keep growing
+        for(size_t pxi = from_px; pxi < to_px; ++pxi)
+        {
+            uint32_t mask = _map.mask_at(pxi);
+            if(mask == 0)
+            {
+                // Short gaps are cheaper to step over than to index
+                if(_run_open && (++_run_gap_px >= RUN_MERGE_GAP_PX))
                 {
-                    if(thres.bits.r >= 0)
-                        { _map[pxi].r = thres.bits.r; }
-                    if(thres.bits.g >= 0)
-                        { _map[pxi].g = thres.bits.g; }
-                    if(thres.bits.b >= 0)
-                        { _map[pxi].b = thres.bits.b; }
-                    if(thres.bits.a >= 0)
-                        { _map[pxi].a = thres.bits.a; }
+                    _run_open = false;
                 }
+                continue;
+            }
+
+            if(_run_open && ((pxi - _runs.back().first_px) >= RUN_MAX_PX))
+            {
+                _run_open = false;
+            }
+            if(!_run_open)
+            {
+                availability_run run;
+                run.first_px = pxi;
+                run.bit_offset = evaluated_data_space();
+                _runs.push_back(run);
+                _run_open = true;
             }
+
+            availability_run& run = _runs.back();
+            run.px_count = pxi - run.first_px + 1;
+            run.bit_count += popcount32(mask);
+            _run_gap_px = 0;
         }
     }
 
-    void availability_map::apply_thresholds_st()
+    void availability_map::reset_packed_map()
     {
-        _vdata_map_map_t vdata_maps;
+        // Collect every availability a pixel can end up with. Each threshold can
+        // only be applied to the states reachable through the previous ones.
+        std::vector<uint16_t> palette = { packed_availability_map::UNSET_WORD };
         for(auto& thres : _thresholds)
         {
-            if(!vdata_maps.count(thres.data_type))
+            threshold_word_ops ops(thres.bits);
+            size_t reachable_count = palette.size();
+            for(size_t i = 0; i < reachable_count; ++i)
+            {
+                uint16_t word = ops.apply(palette[i]);
+                if(std::find(palette.begin(), palette.end(), word) == palette.end())
+                {
+                    palette.push_back(word);
+                }
+            }
+            if(palette.size() > packed_availability_map::MAX_PALETTE_SIZE)
+            {
+                _map.reset(_img->pixel_count(), { });
+                return;
+            }
+        }
+        _map.reset(_img->pixel_count(), std::move(palette));
+    }
+
+    void availability_map::apply_thresholds_segment(
+        size_t from_px,
+        size_t to_px,
+        const threshold_engine& engine)
+    {
+        uint16_t words[WORD_BLOCK_PX];
+        for(size_t pxi = from_px; pxi < to_px; pxi += WORD_BLOCK_PX)
+        {
+            size_t block_px = std::min(WORD_BLOCK_PX, to_px - pxi);
+            engine.evaluate_span(_img->cdata() + (pxi * 4), block_px, words);
+            for(size_t j = 0; j < block_px; ++j)
             {
-                std::vector<float> vdata_map = 
-                    get_visual_data_map(
-                        _img, 
-                        thres.data_type, 
-                        thres.bits
-                    );
-                
-                vdata_maps.emplace(thres.data_type, std::move(vdata_map));
+                _map.set_word(pxi + j, words[j]);
             }
         }
-        apply_thresholds_segment(0, _img->pixel_count() - 1, vdata_maps);
     }
 
-    void availability_map::apply_thresholds_mt(unsigned int thread_count)
+    size_t availability_map::available_data_space()
     {
-        _vdata_map_map_t vdata_maps;
-        for(auto& thres : _thresholds)
+        apply_thresholds();
+        return evaluated_data_space();
+    }
+
+    size_t availability_map::count_data_space() const
+    {
+        if(_img == nullptr)
+        {
+            throw std::logic_error("Thresholds can only be applied to a loaded image");
+        }
+        if(!_modified && (_evaluated_px == _img->pixel_count()))
+        {
+            return evaluated_data_space();
+        }
+        if(_thresholds.empty()) { return 0; }
+
+        threshold_engine engine(_thresholds);
+
+        // With a single visual data type the words only depend on the key
+        bool single_type = std::all_of(_thresholds.begin(), _thresholds.end(), 
+            [&](const availability_threshold& thres)
+            {
+                return thres.data_type == _thresholds[0].data_type;
+            });
+
+        if(single_type)
         {
-            if(!vdata_maps.count(thres.data_type))
+            visual_data_histogram histogram(_img, _thresholds[0].data_type, _thresholds[0].bits);
+            size_t result = 0;
+            for(size_t row = 0; row < histogram.row_count(); ++row)
             {
-                std::vector<float> vdata_map = 
-                    get_visual_data_map(
-                        _img, 
-                        thres.data_type, 
-                        thres.bits
-                    );
-                
-                vdata_maps.emplace(thres.data_type, std::move(vdata_map));
+                for(size_t key = 0; key < histogram.key_count(); ++key)
+                {
+                    uint64_t count = histogram.count(row, key);
+                    if(count == 0) { continue; }
+
+                    visual_data_key vkey = { static_cast<uint16_t>(key), static_cast<uint8_t>(row) };
+                    uint16_t word = engine.evaluate_key(vkey);
+                    result += static_cast<size_t>(count) 
+                            * popcount32(packed_availability_map::word_mask(word));
+                }
             }
+            return result;
         }
 
+        // Otherwise count through the fused engine, storing nothing per pixel
+        worker_pool& pool = worker_pool::shared();
         const size_t pixel_count = _img->pixel_count();
-        const size_t thread_segment_size = pixel_count / thread_count;
+        const size_t segment_count = std::clamp<size_t>(
+            pixel_count / MIN_SEGMENT_PX, 1, pool.thread_count());
+        const size_t segment_px = pixel_count / segment_count;
+        std::vector<size_t> segment_bits(segment_count, 0);
 
-        std::vector<std::thread> threads;
-        for(auto i = 0u; i < thread_count - 1; ++i)
+        pool.parallel_for(segment_count, [&](size_t i)
         {
-            threads.push_back(
-                std::thread(
-                    &availability_map::apply_thresholds_segment,
-                    this,
-                    i * thread_segment_size,
-                    (((size_t)i + 1) * thread_segment_size) - 1,
-                    vdata_maps
-                )
-            );
-        }
-        threads.push_back(
-            std::thread(
-                &availability_map::apply_thresholds_segment,
-                this,
-                (thread_count - 1) * thread_segment_size,
-                thread_count * thread_segment_size + (pixel_count % thread_segment_size),
-                vdata_maps
-            )
-        );
-
-        for(auto& th : threads)
+            size_t from_px = i * segment_px;
+            size_t to_px = (i == segment_count - 1) ? pixel_count : (from_px + segment_px);
+            size_t bits = 0;
+            uint16_t words[WORD_BLOCK_PX];
+            for(size_t pxi = from_px; pxi < to_px; pxi += WORD_BLOCK_PX)
+            {
+                size_t block_px = std::min(WORD_BLOCK_PX, to_px - pxi);
+                engine.evaluate_span(_img->cdata() + (pxi * 4), block_px, words);
+                for(size_t j = 0; j < block_px; ++j)
+                {
+                    bits += popcount32(packed_availability_map::word_mask(words[j]));
+                }
+            }
+            segment_bits[i] = bits;
+        });
+        return std::accumulate(segment_bits.begin(), segment_bits.end(), size_t(0));
+    }
+
+    size_t availability_map::count_data_space(image_reader& reader, size_t max_bits) const
+    {
+        if(_thresholds.empty()) { return 0; }
+
+        threshold_engine engine(_thresholds);
+        const size_t row_px = static_cast<size_t>(reader.width());
+        const int batch_rows = reader.batch_rows();
+        std::vector<uint8_t> pixels(batch_rows * row_px * 4);
+        std::vector<uint32_t> masks(batch_rows * row_px);
+
+        size_t result = 0;
+        while(result < max_bits)
         {
-            th.join();
+            int rows = reader.read_rows(pixels.data(), batch_rows);
+            if(rows == 0) { break; }
+
+            size_t px_count = rows * row_px;
+            evaluate_masks(engine, pixels.data(), px_count, masks.data());
+            for(size_t i = 0; i < px_count; ++i)
+            {
+                result += popcount32(masks[i]);
+            }
         }
+        return result;
     }
 
-    size_t availability_map::available_data_space()
+    const std::vector<availability_threshold>& availability_map::thresholds() const
+    {
+        return _thresholds;
+    }
+
+    void availability_map::evaluate_masks(
+        const threshold_engine& engine, 
+        const uint8_t* px, 
+        size_t px_count, 
+        uint32_t* masks)
     {
-        return std::accumulate<decltype(_map)::const_iterator, size_t>(
-            _map.begin(),
-            _map.end(),
-            0, 
-            [](size_t accum, const pixel_availability& av) -> size_t
+        worker_pool& pool = worker_pool::shared();
+        const size_t segment_count = std::clamp<size_t>(
+            px_count / MIN_SEGMENT_PX, 1, pool.thread_count());
+        const size_t segment_px = px_count / segment_count;
+
+        pool.parallel_for(segment_count, [&](size_t i)
+        {
+            size_t from_px = i * segment_px;
+            size_t to_px = (i == segment_count - 1) ? px_count : (from_px + segment_px);
+            uint16_t words[WORD_BLOCK_PX];
+            for(size_t pxi = from_px; pxi < to_px; pxi += WORD_BLOCK_PX)
             {
-                return accum + (
-                    static_cast<size_t>(std::max<int>(av.r, 0)) +
-                    static_cast<size_t>(std::max<int>(av.g, 0)) +
-                    static_cast<size_t>(std::max<int>(av.b, 0)) +
-                    static_cast<size_t>(std::max<int>(av.a, 0)));
+                size_t block_px = std::min(WORD_BLOCK_PX, to_px - pxi);
+                engine.evaluate_span(px + (pxi * 4), block_px, words);
+                for(size_t j = 0; j < block_px; ++j)
+                {
+                    masks[pxi + j] = packed_availability_map::word_mask(words[j]);
+                }
             }
-        );
+        });
     }
 
     std::string availability_map::generate_key()
@@ -0,0 +1,18 @@
+#include <xsteg/bit_reader.hpp>
+
+namespace xsteg
+{
+    bit_reader::bit_reader(const uint8_t* data_ptr, size_t len)
+    {
+        _data_ptr = data_ptr;
+        _len = len;
+    }
+
+    void bit_reader::seek(size_t bit_idx)
+    {
+        _next_byte = bit_idx / 8;
+        _buffer = 0;
+        _buffer_bits = 0;
+        read(bit_idx % 8);
+    }
+}
\ No newline at end of file
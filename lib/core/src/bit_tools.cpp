@@ -1,4 +1,6 @@
 #include <xsteg/bit_tools.hpp>
+#include <xsteg/bit_writer.hpp>
+
 #include <cassert>
 
 namespace xsteg
@@ -19,14 +21,19 @@ namespace xsteg
     void set_last_bits(uint8_t* byteptr, const std::vector<bool>& bits)
     {
         assert(bits.size() <= 8);
+        uint8_t packed = 0;
         for(size_t i = 0; i < bits.size(); ++i)
         {
-            uint8_t bit = (uint8_t)(bits[i] ? 1 : 0);
-            uint8_t mask = bit << (bits.size() - 1 - i);
-            uint8_t clear_mask = ~(1 << (bits.size() - 1 - i));
-            *byteptr &= clear_mask;
-            *byteptr |= mask;
+            packed = static_cast<uint8_t>((packed << 1) | (bits[i] ? 1 : 0));
         }
+        set_last_bits(byteptr, packed, bits.size());
+    }
+
+    void set_last_bits(uint8_t* byteptr, uint8_t bits, size_t count)
+    {
+        assert(count <= 8);
+        uint8_t mask = static_cast<uint8_t>((1u << count) - 1);
+        *byteptr = static_cast<uint8_t>((*byteptr & ~mask) | (bits & mask));
     }
 
     bool get_bit(uint8_t byte, size_t idx)
@@ -40,21 +47,14 @@ namespace xsteg
     {
         assert((offset_bytes * 8) < data.size());
         std::vector<uint8_t> result;   
-        result.resize((data.size() - (offset_bytes * 8)) * 8, 0x00u);
+        result.resize((data.size() + 7) / 8, 0x00u);
 
-        size_t current_bit = offset_bytes * 8;
-        while(current_bit < data.size())
+        bit_writer writer(result.data() + offset_bytes, result.size() - offset_bytes);
+        for(size_t current_bit = offset_bytes * 8; current_bit < data.size(); ++current_bit)
         {
-            size_t bit_offset = current_bit % 8;
-            size_t byte_idx = current_bit / 8;
-
-            uint8_t bit = (uint8_t)(data[current_bit] ? 1 : 0);
-            
-            uint8_t mask = (uint8_t)bit << (7 - bit_offset);
-            result[byte_idx] |= mask;
-
-            ++current_bit;
+            writer.write(data[current_bit] ? 1 : 0, 1);
         }
+        writer.flush();
 
         return result;
     }
@@ -0,0 +1,30 @@
+#include <xsteg/bit_writer.hpp>
+
+namespace xsteg
+{
+    bit_writer::bit_writer(uint8_t* data_ptr, size_t len)
+    {
+        _data_ptr = data_ptr;
+        _len = len;
+    }
+
+    void bit_writer::flush()
+    {
+        drain();
+        if(_buffer_bits > 0)
+        {
+            if(_next_byte < _len)
+            {
+                _data_ptr[_next_byte] = static_cast<uint8_t>(_buffer >> 56);
+            }
+            _buffer = 0;
+            _buffer_bits = 0;
+            ++_next_byte;
+        }
+    }
+
+    size_t bit_writer::position() const
+    {
+        return (_next_byte * 8) + _buffer_bits;
+    }
+}
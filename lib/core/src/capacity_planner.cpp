@@ -0,0 +1,157 @@
+#include <xsteg/capacity_planner.hpp>
+
+#include <xsteg/pixel_bits.hpp>
+#include <xsteg/visual_data_histogram.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace xsteg
+{
+    // Distinct visual data value of the image, with its pixel count
+    struct value_count
+    {
+        float value = 0;
+        uint64_t count = 0;
+    };
+
+    static std::vector<value_count> get_value_counts(const visual_data_histogram& histogram)
+    {
+        std::vector<value_count> result;
+        for(size_t row = 0; row < histogram.row_count(); ++row)
+        {
+            for(size_t key = 0; key < histogram.key_count(); ++key)
+            {
+                uint64_t count = histogram.count(row, key);
+                if(count == 0) { continue; }
+
+                visual_data_key vkey = { static_cast<uint16_t>(key), static_cast<uint8_t>(row) };
+                float value = get_visual_data_from_key(vkey, histogram.type());
+
+                // Black pixels have no saturation, no threshold ever selects them
+                if(std::isnan(value)) { continue; }
+                result.push_back({ value, count });
+            }
+        }
+
+        std::sort(result.begin(), result.end(), 
+            [](const value_count& lhs, const value_count& rhs)
+            {
+                return lhs.value < rhs.value;
+            });
+
+        std::vector<value_count> merged;
+        for(auto& vc : result)
+        {
+            if(!merged.empty() && (merged.back().value == vc.value))
+                { merged.back().count += vc.count; }
+            else
+                { merged.push_back(vc); }
+        }
+        return merged;
+    }
+
+    // Keys store values with 6 significant digits, so pick a short value within
+    // (lo, hi] (or [lo, hi) when 'include_lo') that survives the round trip
+    static float get_key_value(float lo, float hi, bool include_lo)
+    {
+        auto in_range = [&](float val)
+        {
+            return include_lo ? ((val >= lo) && (val < hi)) : ((val > lo) && (val <= hi));
+        };
+
+        const float candidates[3] = { include_lo ? lo : hi, (lo + hi) / 2.0F, include_lo ? hi : lo };
+        for(int precision = 1; precision <= 6; ++precision)
+        {
+            for(float candidate : candidates)
+            {
+                std::stringstream ss;
+                ss.precision(precision);
+                ss << candidate;
+                float val = std::stof(ss.str());
+                if(in_range(val)) { return val; }
+            }
+        }
+        return include_lo ? lo : hi;
+    }
+
+    capacity_planner::capacity_planner(const image* img)
+    {
+        _img = img;
+    }
+
+    capacity_plan capacity_planner::plan(
+        size_t payload_bytes,
+        visual_data_type type,
+        threshold_direction direction,
+        std::vector<pixel_availability> allowed_bits) const
+    {
+        const size_t required_bits = (payload_bytes * 8) + 64;
+
+        std::stable_sort(allowed_bits.begin(), allowed_bits.end(), 
+            [](const pixel_availability& lhs, const pixel_availability& rhs)
+            {
+                return popcount32(lhs.embed_mask()) < popcount32(rhs.embed_mask());
+            });
+
+        for(const pixel_availability& bits : allowed_bits)
+        {
+            const size_t px_bits = popcount32(bits.embed_mask());
+            if(px_bits == 0) { continue; }
+            const uint64_t required_px = (required_bits + px_bits - 1) / px_bits;
+
+            // The threshold is the first (and only) of its type, so it truncates the visual data
+            visual_data_histogram histogram(_img, type, bits);
+            std::vector<value_count> values = get_value_counts(histogram);
+            if(values.empty()) { continue; }
+
+            // Pixels selected when cutting at each value, going from the most to the least selective
+            std::vector<uint64_t> selected(values.size(), 0);
+            const bool up = direction == threshold_direction::UP;
+            uint64_t total = 0;
+            for(size_t i = 0; i < values.size(); ++i)
+            {
+                total += values[up ? (values.size() - 1 - i) : i].count;
+                selected[i] = total;
+            }
+
+            auto it = std::lower_bound(selected.begin(), selected.end(), required_px);
+            if(it == selected.end()) { continue; }
+
+            size_t step = static_cast<size_t>(std::distance(selected.begin(), it));
+            size_t idx = up ? (values.size() - 1 - step) : step;
+
+            capacity_plan result;
+            result.threshold.data_type = type;
+            result.threshold.direction = direction;
+            result.threshold.bits = bits;
+            if(up)
+            {
+                float lo = (idx > 0) ? values[idx - 1].value : (values[idx].value - 1.0F);
+                result.threshold.value = get_key_value(lo, values[idx].value, false);
+            }
+            else
+            {
+                float hi = (idx + 1 < values.size()) ? values[idx + 1].value : (values[idx].value + 1.0F);
+                result.threshold.value = get_key_value(values[idx].value, hi, true);
+            }
+            result.pixel_count = static_cast<size_t>(*it);
+            result.data_space = result.pixel_count * px_bits;
+            return result;
+        }
+
+        std::stringstream ss;
+        ss << "Not enough available space to encode data! "
+           << "Requested [" 
+           << required_bits
+           << "]b to encode, while no allowed bit mask can hold it for the given image.";
+        throw std::overflow_error(ss.str());
+    }
+
+    std::string capacity_planner::plan_key(const capacity_plan& plan)
+    {
+        return generate_thresholds_key({ plan.threshold });
+    }
+}
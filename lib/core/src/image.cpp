@@ -1,10 +1,20 @@
 #include <xsteg/image.hpp>
 #include <xsteg/availability_map.hpp>
+#include <xsteg/image_writer.hpp>
+#include <xsteg/mapped_file.hpp>
+#include <xsteg/png_stripes.hpp>
+#include <xsteg/worker_pool.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
 
 #include "stb_image.h"
 #include "stb_image_write.h"
@@ -29,13 +39,18 @@ namespace xsteg
         read_from_file(fname);
     }
 
+    image::image(const uint8_t* encoded_data, size_t len)
+    {
+        read_from_memory(encoded_data, len);
+    }
+
     image::~image()
     {
         if(_loaded_stbi)
         {
             stbi_image_free(_data);
         }
-        else
+        else if(_mapping == nullptr)
         {
             delete[](_data);
         }
@@ -48,6 +63,7 @@ namespace xsteg
         _height = mv_src._height;
         _channels = mv_src._channels;
         _loaded_stbi = mv_src._loaded_stbi;
+        _mapping = std::move(mv_src._mapping);
 
         mv_src._data = nullptr;
         mv_src._channels = -1;
@@ -63,6 +79,7 @@ namespace xsteg
         _height = mv_src._height;
         _channels = mv_src._channels;
         _loaded_stbi = mv_src._loaded_stbi;
+        _mapping = std::move(mv_src._mapping);
 
         mv_src._data = nullptr;
         mv_src._channels = -1;
@@ -107,14 +124,37 @@ namespace xsteg
 
     void image::read_from_file(const std::string& fname)
     {
-        _loaded_stbi = true;
-        _data = stbi_load(
-            fname.c_str(), 
-            &_width, 
-            &_height, 
-            &_channels, 
-            4
-        );
+        // Decoded from a mapping of the file, which RGBA pam images keep
+        // using instead of a copy of their pixels
+        std::unique_ptr<mapped_file> mapping = mapped_file::open(fname);
+        if((mapping != nullptr) && (mapping->size() > 0))
+        {
+            if(read_pam(mapping->data(), mapping->size(), mapping)
+                || read_striped_png(mapping->data(), mapping->size()))
+            {
+                return;
+            }
+
+            _loaded_stbi = true;
+            _data = stbi_load_from_memory(
+                mapping->data(),
+                static_cast<int>(mapping->size()),
+                &_width,
+                &_height,
+                &_channels,
+                4);
+        }
+        else
+        {
+            _loaded_stbi = true;
+            _data = stbi_load(
+                fname.c_str(), 
+                &_width, 
+                &_height, 
+                &_channels, 
+                4
+            );
+        }
         _channels = 4;
         if(_data == nullptr)
         {
@@ -124,17 +164,178 @@ namespace xsteg
         }
     }
 
+    void image::read_from_memory(const uint8_t* encoded_data, size_t len)
+    {
+        std::unique_ptr<mapped_file> no_mapping;
+        if(read_pam(encoded_data, len, no_mapping) || read_striped_png(encoded_data, len))
+        {
+            return;
+        }
+
+        _loaded_stbi = true;
+        _data = stbi_load_from_memory(
+            encoded_data,
+            static_cast<int>(len),
+            &_width,
+            &_height,
+            &_channels,
+            4
+        );
+        _channels = 4;
+        if(_data == nullptr)
+        {
+			throw std::invalid_argument("Unable to decode image data");
+        }
+    }
+
+    bool image::read_striped_png(const uint8_t* encoded_data, size_t len)
+    {
+        striped_png png(encoded_data, len);
+        if(!png.is_striped())
+        {
+            return false;
+        }
+
+        std::unique_ptr<uint8_t[]> pixels(
+            new uint8_t[static_cast<size_t>(png.width()) * static_cast<size_t>(png.height()) * 4]);
+        if(!png.decode(pixels.get()))
+        {
+            return false;
+        }
+
+        _loaded_stbi = false;
+        _data = pixels.release();
+        _width = png.width();
+        _height = png.height();
+        _channels = 4;
+        return true;
+    }
+
+    // Reads the header of a pam image, up to ENDHDR. Only 8 bit samples
+    // of 1 to 4 channels (gray, gray and alpha, RGB, RGBA) are supported.
+    static bool parse_pam_header(
+        const uint8_t* data, 
+        size_t len, 
+        int& width, 
+        int& height, 
+        int& depth, 
+        size_t& header_len)
+    {
+        if((len < 3) || (std::memcmp(data, "P7\n", 3) != 0))
+        {
+            return false;
+        }
+
+        int maxval = 0;
+        size_t pos = 3;
+        while(pos < len)
+        {
+            const uint8_t* line_end = static_cast<const uint8_t*>(std::memchr(data + pos, '\n', len - pos));
+            if(line_end == nullptr) { return false; }
+
+            std::istringstream line(std::string(reinterpret_cast<const char*>(data + pos), line_end - (data + pos)));
+            pos = (line_end - data) + 1;
+
+            std::string key;
+            line >> key;
+            if(key == "WIDTH")          { line >> width; }
+            else if(key == "HEIGHT")    { line >> height; }
+            else if(key == "DEPTH")     { line >> depth; }
+            else if(key == "MAXVAL")    { line >> maxval; }
+            else if(key == "ENDHDR")
+            {
+                header_len = pos;
+                return (width > 0) && (height > 0) && (depth >= 1) && (depth <= 4) && (maxval == 255);
+            }
+        }
+        return false;
+    }
+
+    bool image::read_pam(const uint8_t* encoded_data, size_t len, std::unique_ptr<mapped_file>& mapping)
+    {
+        int width = 0;
+        int height = 0;
+        int depth = 0;
+        size_t header_len = 0;
+        if(!parse_pam_header(encoded_data, len, width, height, depth, header_len))
+        {
+            return false;
+        }
+
+        const size_t px_count = static_cast<size_t>(width) * static_cast<size_t>(height);
+        if((len - header_len) / static_cast<size_t>(depth) < px_count)
+        {
+            return false;
+        }
+
+        _width = width;
+        _height = height;
+        _channels = 4;
+        _loaded_stbi = false;
+
+        const uint8_t* src = encoded_data + header_len;
+        if((depth == 4) && (mapping != nullptr))
+        {
+            _mapping = std::move(mapping);
+            _data = _mapping->data() + header_len;
+            return true;
+        }
+
+        _data = new uint8_t[px_count * 4];
+        for(size_t i = 0; i < px_count; ++i)
+        {
+            const uint8_t* in = src + (i * depth);
+            uint8_t* out = _data + (i * 4);
+            const bool gray = (depth <= 2);
+            const bool alpha = (depth == 2) || (depth == 4);
+            out[0] = in[0];
+            out[1] = gray ? in[0] : in[1];
+            out[2] = gray ? in[0] : in[2];
+            out[3] = alpha ? in[depth - 1] : 0xFF;
+        }
+        return true;
+    }
+
+    void image::detach_mapping()
+    {
+        if(_mapping == nullptr)
+        {
+            return;
+        }
+
+        uint8_t* pixels = new uint8_t[pixel_count() * 4];
+        std::memcpy(pixels, _data, pixel_count() * 4);
+        _data = pixels;
+        _mapping.reset();
+    }
+
     void image::write_to_file(const std::string& fname, image_save_options opt)
     {
+        // Pixels mapped from the file being written would be lost with it
+        std::error_code ec;
+        if((_mapping != nullptr) && std::filesystem::equivalent(_mapping->fname(), fname, ec))
+        {
+            detach_mapping();
+        }
+
         switch(opt.format)
         {
             case image_format::png:
             {
-                write_to_file_png(fname);
+                write_to_file_png(fname, opt);
+                break;
             }
             case image_format::jpeg:
             {
                 write_to_file_jpeg(fname, opt.jpeg_quality);
+                break;
+            }
+            case image_format::pam:
+            case image_format::bmp:
+            case image_format::tga:
+            {
+                write_to_file_uncompressed(fname, opt.format);
+                break;
             }
         }
     }
@@ -197,22 +398,11 @@ namespace xsteg
         }
     }
 
-    void image::write_to_file_png(const std::string& fname)
+    void image::write_to_file_png(const std::string& fname, const image_save_options& opt)
     {
-        int result = stbi_write_png(
-            fname.c_str(), 
-            _width, 
-            _height, 
-            static_cast<int>(_channels), 
-            _data, 
-            _width * static_cast<int>(_channels)
-        );
-        if(result == 0)
-        {
-			throw std::invalid_argument(
-				std::string("Unable to save png image file: [") + fname + "]"
-			);
-        }
+        // Stripes are filtered and deflated in parallel
+        image_writer writer(fname, _width, _height, opt);
+        writer.write_rows(_data, _height);
     }
 
     void image::write_to_file_jpeg(const std::string& fname, int quality)
@@ -232,4 +422,179 @@ namespace xsteg
 			);
         }
     }
+
+    static void store_le16(uint8_t* dst, uint32_t value)
+    {
+        dst[0] = static_cast<uint8_t>(value);
+        dst[1] = static_cast<uint8_t>(value >> 8);
+    }
+
+    static void store_le32(uint8_t* dst, uint32_t value)
+    {
+        store_le16(dst, value);
+        store_le16(dst + 2, value >> 16);
+    }
+
+    static const char* format_name(image_format format)
+    {
+        switch(format)
+        {
+            case image_format::png:     { return "png"; }
+            case image_format::jpeg:    { return "jpeg"; }
+            case image_format::pam:     { return "pam"; }
+            case image_format::bmp:     { return "bmp"; }
+            case image_format::tga:     { return "tga"; }
+        }
+        return "";
+    }
+
+    std::vector<uint8_t> image::uncompressed_header(image_format format) const
+    {
+        const size_t px_bytes = pixel_count() * 4;
+        std::vector<uint8_t> header;
+        switch(format)
+        {
+            case image_format::pam:
+            {
+                const std::string text = 
+                    "P7\nWIDTH " + std::to_string(_width) + 
+                    "\nHEIGHT " + std::to_string(_height) + 
+                    "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+                header.assign(text.begin(), text.end());
+                break;
+            }
+            case image_format::bmp:
+            {
+                // 32 bit rows need no padding, they are stored bottom-up
+                if(54 + px_bytes > UINT32_MAX) { break; }
+
+                header.resize(54, 0);
+                header[0] = 'B';
+                header[1] = 'M';
+                store_le32(header.data() + 2, static_cast<uint32_t>(54 + px_bytes));
+                store_le32(header.data() + 10, 54);
+                store_le32(header.data() + 14, 40);
+                store_le32(header.data() + 18, static_cast<uint32_t>(_width));
+                store_le32(header.data() + 22, static_cast<uint32_t>(_height));
+                store_le16(header.data() + 26, 1);
+                store_le16(header.data() + 28, 32);
+                store_le32(header.data() + 34, static_cast<uint32_t>(px_bytes));
+                break;
+            }
+            case image_format::tga:
+            {
+                // Uncompressed true color, rows top-down (descriptor bit 5), 8 alpha bits
+                if((_width > UINT16_MAX) || (_height > UINT16_MAX)) { break; }
+
+                header.resize(18, 0);
+                header[2] = 2;
+                store_le16(header.data() + 12, static_cast<uint32_t>(_width));
+                store_le16(header.data() + 14, static_cast<uint32_t>(_height));
+                header[16] = 32;
+                header[17] = 0x28;
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+        return header;
+    }
+
+    void image::store_uncompressed_pixels(image_format format, uint8_t* dst) const
+    {
+        const size_t row_bytes = static_cast<size_t>(_width) * 4;
+        const size_t px_bytes = pixel_count() * 4;
+
+        if(format == image_format::pam)
+        {
+            // Stored as they are, copied in blocks by every thread
+            constexpr size_t block_bytes = 1 << 20;
+            worker_pool::shared().parallel_for((px_bytes + block_bytes - 1) / block_bytes, [&](size_t block)
+            {
+                const size_t from = block * block_bytes;
+                std::memcpy(dst + from, _data + from, std::min(block_bytes, px_bytes - from));
+            });
+            return;
+        }
+
+        const bool bottom_up = (format == image_format::bmp);
+        worker_pool::shared().parallel_for(static_cast<size_t>(_height), [&](size_t row)
+        {
+            const uint8_t* in = _data + (row * row_bytes);
+            uint8_t* out = dst + ((bottom_up ? (_height - 1 - row) : row) * row_bytes);
+            for(size_t x = 0; x < row_bytes; x += 4)
+            {
+                out[x + 0] = in[x + 2];
+                out[x + 1] = in[x + 1];
+                out[x + 2] = in[x + 0];
+                out[x + 3] = in[x + 3];
+            }
+        });
+    }
+
+    void image::write_to_file_uncompressed(const std::string& fname, image_format format)
+    {
+        const std::vector<uint8_t> header = uncompressed_header(format);
+        std::unique_ptr<mapped_file> file;
+        if(!header.empty())
+        {
+            file = mapped_file::create(fname, header.size() + (pixel_count() * 4));
+        }
+        if(file == nullptr)
+        {
+			throw std::invalid_argument(
+				std::string("Unable to save ") + format_name(format) + " image file: [" + fname + "]"
+			);
+        }
+
+        std::memcpy(file->data(), header.data(), header.size());
+        store_uncompressed_pixels(format, file->data() + header.size());
+    }
+
+    std::vector<uint8_t> image::write_to_memory(image_save_options opt) const
+    {
+        std::vector<uint8_t> result;
+        switch(opt.format)
+        {
+            case image_format::png:
+            {
+                image_writer writer(result, _width, _height, opt);
+                writer.write_rows(_data, _height);
+                break;
+            }
+            case image_format::jpeg:
+            {
+                auto append = [](void* context, void* data, int size)
+                {
+                    std::vector<uint8_t>* dst = static_cast<std::vector<uint8_t>*>(context);
+                    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+                    dst->insert(dst->end(), bytes, bytes + size);
+                };
+                if(stbi_write_jpg_to_func(append, &result, _width, _height, 4, _data, opt.jpeg_quality) == 0)
+                {
+                    throw std::invalid_argument("Unable to encode jpeg image");
+                }
+                break;
+            }
+            case image_format::pam:
+            case image_format::bmp:
+            case image_format::tga:
+            {
+                const std::vector<uint8_t> header = uncompressed_header(opt.format);
+                if(header.empty())
+                {
+                    throw std::invalid_argument(
+                        std::string("Unable to encode ") + format_name(opt.format) + " image"
+                    );
+                }
+                result.resize(header.size() + (pixel_count() * 4));
+                std::memcpy(result.data(), header.data(), header.size());
+                store_uncompressed_pixels(opt.format, result.data() + header.size());
+                break;
+            }
+        }
+        return result;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,517 @@
+#include <xsteg/image_reader.hpp>
+
+#include <xsteg/png_chunks.hpp>
+#include <xsteg/png_filter.hpp>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace xsteg
+{
+    static const size_t IDAT_BUFFER_SIZE = 1 << 16;
+    static const size_t SKIP_BUFFER_SIZE = 4096;
+
+    // Gray levels below 8 bits are scaled the same way stb_image does
+    static const uint8_t DEPTH_SCALE[9] = { 0, 0xFF, 0x55, 0, 0x11, 0, 0, 0, 0x01 };
+
+    enum png_color_type : uint8_t
+    {
+        GRAY = 0,
+        RGB = 2,
+        PALETTE = 3,
+        GRAY_ALPHA = 4,
+        RGBA = 6
+    };
+
+    struct image_reader::png_stream
+    {
+        png_chunk_iterator chunks;
+
+        z_stream zs = { };
+        bool zs_initialized = false;
+
+        uint8_t color_type = 0;
+        uint8_t bit_depth = 0;
+        size_t filter_bpp = 0;
+
+        // Filter type byte followed by the row bytes
+        std::vector<uint8_t> row;
+        std::vector<uint8_t> prev_row;
+
+        std::array<uint8_t, 256 * 4> palette = { };
+        bool has_palette = false;
+        bool has_trns = false;
+        uint16_t trns[3] = { };
+
+        std::vector<uint8_t> idat_buffer;
+        uint32_t idat_left = 0;
+        bool idat_done = false;
+
+        explicit png_stream(png_chunk_iterator::read_func read)
+            : chunks(std::move(read))
+        { }
+
+        ~png_stream()
+        {
+            if(zs_initialized) { inflateEnd(&zs); }
+        }
+    };
+
+    image_reader::image_reader(const std::string& fname)
+        : _fname(fname)
+    {
+        _file = std::fopen(fname.c_str(), "rb");
+        if(_file == nullptr)
+        {
+            throw std::invalid_argument(
+                std::string("Unable to open image file: [") + fname + "]"
+            );
+        }
+        _owns_file = true;
+        open();
+    }
+
+    image_reader::image_reader(std::FILE* stream)
+        : _fname("<stream>")
+    {
+        _file = stream;
+        _owns_file = false;
+        _keep_header = true;
+        open();
+    }
+
+    void image_reader::open()
+    {
+        bool streaming = false;
+        try
+        {
+            streaming = open_png();
+        }
+        catch(...)
+        {
+            close();
+            throw;
+        }
+
+        if(streaming)
+        {
+            _keep_header = false;
+            std::vector<uint8_t>().swap(_header_bytes);
+            return;
+        }
+
+        // Not a PNG this reader can stream, decode it whole instead
+        if(_owns_file)
+        {
+            close();
+            _decoded = std::make_unique<image>(_fname);
+        }
+        else
+        {
+            // The bytes already taken from the stream go first
+            std::vector<uint8_t> data = std::move(_header_bytes);
+            uint8_t buffer[SKIP_BUFFER_SIZE];
+            size_t count = 0;
+            while((count = std::fread(buffer, 1, sizeof(buffer), _file)) > 0)
+            {
+                data.insert(data.end(), buffer, buffer + count);
+            }
+            close();
+            _decoded = std::make_unique<image>(data.data(), data.size());
+        }
+        _width = _decoded->width();
+        _height = _decoded->height();
+    }
+
+    image_reader::~image_reader()
+    {
+        close();
+    }
+
+    int image_reader::width() const { return _width; }
+
+    int image_reader::height() const { return _height; }
+
+    size_t image_reader::pixel_count() const
+    {
+        return static_cast<size_t>(_width) * static_cast<size_t>(_height);
+    }
+
+    int image_reader::rows_read() const { return _rows_read; }
+
+    int image_reader::batch_rows() const
+    {
+        return static_cast<int>(std::max<size_t>(1, BATCH_PX / static_cast<size_t>(_width)));
+    }
+
+    bool image_reader::is_streaming() const
+    {
+        return _decoded == nullptr;
+    }
+
+    int image_reader::read_rows(uint8_t* dst, int max_rows)
+    {
+        int row_count = std::min(max_rows, _height - _rows_read);
+        if(row_count <= 0) { return 0; }
+
+        const size_t row_bytes = static_cast<size_t>(_width) * 4;
+        if(_decoded)
+        {
+            std::memcpy(dst, _decoded->cdata() + (_rows_read * row_bytes), row_count * row_bytes);
+        }
+        else
+        {
+            for(int i = 0; i < row_count; ++i)
+            {
+                inflate_row();
+                unfilter_row();
+                convert_row(dst + (i * row_bytes));
+            }
+        }
+
+        _rows_read += row_count;
+        if(_rows_read == _height)
+        {
+            close();
+        }
+        return row_count;
+    }
+
+    bool image_reader::open_png()
+    {
+        _png = std::make_unique<png_stream>([this](uint8_t* dst, size_t len)
+        {
+            return read_bytes(dst, len);
+        });
+        png_stream& png = *_png;
+        if(!png.chunks.read_signature()) { return false; }
+
+        bool has_header = false;
+
+        while(true)
+        {
+            png_chunk chunk;
+            next_chunk(chunk);
+            const uint32_t len = chunk.length;
+
+            if(chunk.is("IHDR"))
+            {
+                if(len != 13) { throw_corrupt("bad IHDR"); }
+                uint8_t ihdr[13];
+                read_exact(ihdr, 13);
+                uint32_t width = load_be32(ihdr);
+                uint32_t height = load_be32(ihdr + 4);
+                png.bit_depth = ihdr[8];
+                png.color_type = ihdr[9];
+
+                if(width == 0 || height == 0 || width > PNG_MAX_DIMENSION || height > PNG_MAX_DIMENSION)
+                {
+                    throw_corrupt("bad image dimensions");
+                }
+                if(ihdr[10] != 0 || ihdr[11] != 0) { throw_corrupt("bad compression or filter method"); }
+
+                // Interlaced images are left to the whole image decoder
+                if(ihdr[12] != 0) { return false; }
+
+                size_t channels = 0;
+                switch(png.color_type)
+                {
+                    case GRAY: channels = 1; break;
+                    case RGB: channels = 3; break;
+                    case PALETTE: channels = 1; break;
+                    case GRAY_ALPHA: channels = 2; break;
+                    case RGBA: channels = 4; break;
+                    default: throw_corrupt("bad color type");
+                }
+                bool valid_depth = (png.bit_depth == 8)
+                    || (png.bit_depth == 16 && png.color_type != PALETTE)
+                    || ((png.bit_depth == 1 || png.bit_depth == 2 || png.bit_depth == 4)
+                        && (png.color_type == GRAY || png.color_type == PALETTE));
+                if(!valid_depth) { throw_corrupt("bad bit depth"); }
+
+                _width = static_cast<int>(width);
+                _height = static_cast<int>(height);
+
+                size_t row_bits = static_cast<size_t>(width) * channels * png.bit_depth;
+                png.filter_bpp = std::max<size_t>(1, (channels * png.bit_depth) / 8);
+                png.row.assign(1 + ((row_bits + 7) / 8), 0);
+                png.prev_row.assign(png.row.size(), 0);
+                has_header = true;
+            }
+            else if(!has_header)
+            {
+                throw_corrupt("IHDR is not the first chunk");
+            }
+            else if(chunk.is("PLTE"))
+            {
+                if(len > 256 * 3 || (len % 3) != 0) { throw_corrupt("bad PLTE"); }
+                uint8_t plte[256 * 3];
+                read_exact(plte, len);
+                for(size_t i = 0; i < len / 3; ++i)
+                {
+                    png.palette[(i * 4) + 0] = plte[(i * 3) + 0];
+                    png.palette[(i * 4) + 1] = plte[(i * 3) + 1];
+                    png.palette[(i * 4) + 2] = plte[(i * 3) + 2];
+                    png.palette[(i * 4) + 3] = 0xFF;
+                }
+                png.has_palette = true;
+            }
+            else if(chunk.is("tRNS"))
+            {
+                uint8_t trns[256];
+                if(len > 256) { throw_corrupt("bad tRNS"); }
+                read_exact(trns, len);
+
+                if(png.color_type == PALETTE)
+                {
+                    for(size_t i = 0; i < len; ++i)
+                    {
+                        png.palette[(i * 4) + 3] = trns[i];
+                    }
+                }
+                else if(png.color_type == GRAY && len == 2)
+                {
+                    png.trns[0] = load_be16(trns);
+                    png.has_trns = true;
+                }
+                else if(png.color_type == RGB && len == 6)
+                {
+                    png.trns[0] = load_be16(trns);
+                    png.trns[1] = load_be16(trns + 2);
+                    png.trns[2] = load_be16(trns + 4);
+                    png.has_trns = true;
+                }
+            }
+            else if(chunk.is("IDAT"))
+            {
+                if(png.color_type == PALETTE && !png.has_palette) { throw_corrupt("missing PLTE"); }
+
+                png.idat_left = len;
+                png.idat_buffer.resize(IDAT_BUFFER_SIZE);
+                if(inflateInit(&png.zs) != Z_OK) { throw_corrupt("zlib initialization failed"); }
+                png.zs_initialized = true;
+                return true;
+            }
+            else if(chunk.is("IEND"))
+            {
+                throw_corrupt("no image data");
+            }
+        }
+    }
+
+    void image_reader::close()
+    {
+        _png.reset();
+        if(_file != nullptr)
+        {
+            if(_owns_file) { std::fclose(_file); }
+            _file = nullptr;
+        }
+    }
+
+    void image_reader::throw_corrupt(const char* reason) const
+    {
+        throw std::invalid_argument(
+            std::string("Corrupt png image file (") + reason + "): [" + _fname + "]"
+        );
+    }
+
+    bool image_reader::read_bytes(uint8_t* dst, size_t len)
+    {
+        // Skipped bytes are read through rather than seeked over, so pipes work too
+        uint8_t buffer[SKIP_BUFFER_SIZE];
+        while(len > 0)
+        {
+            uint8_t* out = (dst != nullptr) ? dst : buffer;
+            size_t want = (dst != nullptr) ? len : std::min(len, sizeof(buffer));
+            size_t count = std::fread(out, 1, want, _file);
+            if(_keep_header)
+            {
+                _header_bytes.insert(_header_bytes.end(), out, out + count);
+            }
+            if(count != want) { return false; }
+
+            if(dst != nullptr) { dst += count; }
+            len -= count;
+        }
+        return true;
+    }
+
+    void image_reader::read_exact(void* dst, size_t len)
+    {
+        if(!_png->chunks.read_data(static_cast<uint8_t*>(dst), len))
+        {
+            throw_corrupt("unexpected end of file");
+        }
+    }
+
+    void image_reader::next_chunk(png_chunk& chunk)
+    {
+        if(!_png->chunks.next(chunk))
+        {
+            throw_corrupt("unexpected end of file");
+        }
+    }
+
+    size_t image_reader::read_idat(uint8_t* dst, size_t len)
+    {
+        png_stream& png = *_png;
+        while(png.idat_left == 0)
+        {
+            if(png.idat_done) { return 0; }
+
+            // Image data may go on in the next chunk
+            png_chunk chunk;
+            next_chunk(chunk);
+            if(!chunk.is("IDAT"))
+            {
+                png.idat_done = true;
+                return 0;
+            }
+            png.idat_left = chunk.length;
+        }
+
+        size_t count = std::min<size_t>(len, png.idat_left);
+        read_exact(dst, count);
+        png.idat_left -= static_cast<uint32_t>(count);
+        return count;
+    }
+
+    void image_reader::inflate_row()
+    {
+        png_stream& png = *_png;
+        png.zs.next_out = png.row.data();
+        png.zs.avail_out = static_cast<uInt>(png.row.size());
+
+        while(png.zs.avail_out > 0)
+        {
+            if(png.zs.avail_in == 0)
+            {
+                size_t count = read_idat(png.idat_buffer.data(), png.idat_buffer.size());
+                if(count == 0) { throw_corrupt("image data ends early"); }
+                png.zs.next_in = png.idat_buffer.data();
+                png.zs.avail_in = static_cast<uInt>(count);
+            }
+
+            int result = inflate(&png.zs, Z_NO_FLUSH);
+            if(result == Z_STREAM_END)
+            {
+                if(png.zs.avail_out > 0) { throw_corrupt("image data ends early"); }
+                break;
+            }
+            if(result != Z_OK && !(result == Z_BUF_ERROR && png.zs.avail_in == 0))
+            {
+                throw_corrupt("bad image data");
+            }
+        }
+    }
+
+    void image_reader::unfilter_row()
+    {
+        png_stream& png = *_png;
+        bool known_filter = png_unfilter_row(
+            png.row[0], 
+            png.row.data() + 1, 
+            png.prev_row.data() + 1, 
+            png.row.size() - 1, 
+            png.filter_bpp);
+
+        if(!known_filter) { throw_corrupt("bad filter type"); }
+
+        // The unfiltered row is the reference for the next one
+        std::swap(png.row, png.prev_row);
+    }
+
+    void image_reader::convert_row(uint8_t* dst) const
+    {
+        const png_stream& png = *_png;
+        const uint8_t* src = png.prev_row.data() + 1;
+        const size_t width = static_cast<size_t>(_width);
+
+        if(png.bit_depth < 8)
+        {
+            const unsigned depth = png.bit_depth;
+            const unsigned max_val = (1u << depth) - 1;
+            const uint8_t trns_gray = static_cast<uint8_t>((png.trns[0] & 0xFF) * DEPTH_SCALE[depth]);
+            for(size_t x = 0; x < width; ++x)
+            {
+                size_t bit = x * depth;
+                unsigned val = (src[bit / 8] >> (8 - depth - (bit % 8))) & max_val;
+                uint8_t* px = dst + (x * 4);
+                if(png.color_type == PALETTE)
+                {
+                    std::memcpy(px, png.palette.data() + (val * 4), 4);
+                }
+                else
+                {
+                    uint8_t gray = static_cast<uint8_t>(val * DEPTH_SCALE[depth]);
+                    px[0] = px[1] = px[2] = gray;
+                    px[3] = (png.has_trns && gray == trns_gray) ? 0 : 0xFF;
+                }
+            }
+            return;
+        }
+
+        // 16 bit samples keep their high byte, tRNS is matched on the whole sample
+        const size_t sample_bytes = png.bit_depth / 8;
+        auto sample = [&](size_t idx) -> uint16_t
+        {
+            return (sample_bytes == 2) ? load_be16(src + (idx * 2)) : src[idx];
+        };
+        auto high_byte = [&](size_t idx) -> uint8_t
+        {
+            return src[idx * sample_bytes];
+        };
+        const uint16_t trns_mask = (sample_bytes == 2) ? 0xFFFFu : 0x00FFu;
+
+        for(size_t x = 0; x < width; ++x)
+        {
+            uint8_t* px = dst + (x * 4);
+            switch(png.color_type)
+            {
+                case GRAY:
+                {
+                    px[0] = px[1] = px[2] = high_byte(x);
+                    px[3] = (png.has_trns && sample(x) == (png.trns[0] & trns_mask)) ? 0 : 0xFF;
+                    break;
+                }
+                case RGB:
+                {
+                    px[0] = high_byte((x * 3) + 0);
+                    px[1] = high_byte((x * 3) + 1);
+                    px[2] = high_byte((x * 3) + 2);
+                    bool transparent = png.has_trns
+                        && sample((x * 3) + 0) == (png.trns[0] & trns_mask)
+                        && sample((x * 3) + 1) == (png.trns[1] & trns_mask)
+                        && sample((x * 3) + 2) == (png.trns[2] & trns_mask);
+                    px[3] = transparent ? 0 : 0xFF;
+                    break;
+                }
+                case PALETTE:
+                {
+                    std::memcpy(px, png.palette.data() + (src[x] * 4), 4);
+                    break;
+                }
+                case GRAY_ALPHA:
+                {
+                    px[0] = px[1] = px[2] = high_byte((x * 2) + 0);
+                    px[3] = high_byte((x * 2) + 1);
+                    break;
+                }
+                case RGBA:
+                {
+                    px[0] = high_byte((x * 4) + 0);
+                    px[1] = high_byte((x * 4) + 1);
+                    px[2] = high_byte((x * 4) + 2);
+                    px[3] = high_byte((x * 4) + 3);
+                    break;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,722 @@
+#include <xsteg/image_writer.hpp>
+
+#include <xsteg/png_chunks.hpp>
+#include <xsteg/png_filter.hpp>
+#include <xsteg/png_stripes.hpp>
+#include <xsteg/worker_pool.hpp>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+namespace xsteg
+{
+    static const size_t DEFLATE_WINDOW = 1 << 15;
+
+    struct image_writer::stripe
+    {
+        const uint8_t* src = nullptr;
+        int row_count = 0;
+        bool first = false;
+        bool last = false;
+
+        // Filter type byte followed by the filtered row, for every row
+        std::vector<uint8_t> filtered;
+        std::vector<uint8_t> compressed;
+        uint32_t adler = 1;
+    };
+
+    // zlib header (32K window, deflate), flagged with the compression level
+    static void put_zlib_header(int level, std::vector<uint8_t>& dst)
+    {
+        const uint8_t cmf = 0x78;
+        const int flevel = (level < 2) ? 0
+                         : (level < 6) ? 1
+                         : (level == 6) ? 2 : 3;
+        uint8_t flg = static_cast<uint8_t>(flevel << 6);
+        flg = static_cast<uint8_t>(flg + ((31 - (((cmf << 8) | flg) % 31)) % 31));
+        dst.push_back(cmf);
+        dst.push_back(flg);
+    }
+
+    // Adler-32 of some data after replacing a part of it with as many bytes,
+    // given the checksums of the old and new part and the bytes after them
+    static uint32_t adler32_replace(uint32_t whole, uint32_t old_part, uint32_t new_part, size_t bytes_after)
+    {
+        // The first sum adds every byte, the second weighs each one by its
+        // distance to the end of the data
+        const uint64_t BASE = 65521;
+        const uint64_t delta1 = ((new_part & 0xFFFF) + BASE - (old_part & 0xFFFF)) % BASE;
+        const uint64_t delta2 = ((new_part >> 16) + BASE - (old_part >> 16)
+            + ((bytes_after % BASE) * delta1)) % BASE;
+
+        const uint64_t sum1 = ((whole & 0xFFFF) + delta1) % BASE;
+        const uint64_t sum2 = ((whole >> 16) + delta2) % BASE;
+        return static_cast<uint32_t>((sum2 << 16) | sum1);
+    }
+
+    static bool read_at(std::FILE* file, long offset, void* dst, size_t len)
+    {
+        return (std::fseek(file, offset, SEEK_SET) == 0)
+            && (std::fread(dst, 1, len, file) == len);
+    }
+
+    struct idat_chunk
+    {
+        long offset = 0;
+        uint32_t length = 0;
+    };
+
+    // Finds the IDAT chunks of an RGBA png of the given size if they are laid out
+    // as image_writer writes them: more than one, all but the last ending on a
+    // sync flush. Also reads the Adler-32 of the whole image data, and the
+    // filtered bytes of every chunk when they are listed (see png_stripes.hpp).
+    static bool scan_idat_chunks(
+        std::FILE* file,
+        int width,
+        int height,
+        std::vector<idat_chunk>& chunks,
+        uint32_t& adler,
+        std::vector<uint32_t>& stripe_lengths)
+    {
+        // Chunks are bounded by the size of the file, the ones not needed are seeked over
+        long file_size = -1;
+        if(std::fseek(file, 0, SEEK_END) == 0)
+        {
+            file_size = std::ftell(file);
+        }
+        if((file_size < 0) || (std::fseek(file, 0, SEEK_SET) != 0))
+        {
+            return false;
+        }
+
+        png_chunk_iterator png([file](uint8_t* dst, size_t len)
+        {
+            return (dst != nullptr)
+                ? (std::fread(dst, 1, len, file) == len)
+                : (std::fseek(file, static_cast<long>(len), SEEK_CUR) == 0);
+        }, static_cast<size_t>(file_size));
+        if(!png.read_signature())
+        {
+            return false;
+        }
+
+        uint8_t buf[13];
+        bool header_ok = false;
+        png_chunk chunk;
+        while(true)
+        {
+            if(!png.next(chunk)) { return false; }
+
+            if(chunk.is("IHDR"))
+            {
+                if((chunk.length != 13) || !png.read_data(buf, 13)) { return false; }
+                header_ok = (load_be32(buf) == static_cast<uint32_t>(width))
+                         && (load_be32(buf + 4) == static_cast<uint32_t>(height))
+                         && (buf[8] == 8) && (buf[9] == 6)
+                         && (buf[10] == 0) && (buf[11] == 0) && (buf[12] == 0);
+            }
+            else if(chunk.is("IDAT"))
+            {
+                chunks.push_back({ static_cast<long>(chunk.offset), chunk.length });
+            }
+            else if(chunk.is(PNG_STRIPES_CHUNK))
+            {
+                std::vector<uint8_t> payload(chunk.length);
+                if(!png.read_data(payload.data(), chunk.length)
+                    || !decode_png_stripes(payload.data(), chunk.length, stripe_lengths))
+                {
+                    stripe_lengths.clear();
+                }
+            }
+            else if(chunk.is("IEND"))
+            {
+                break;
+            }
+        }
+
+        if(!header_ok || (chunks.size() < 2) || (chunks.back().length < 4))
+        {
+            return false;
+        }
+
+        static const uint8_t SYNC_FLUSH_END[4] = { 0x00, 0x00, 0xFF, 0xFF };
+        for(size_t i = 0; i + 1 < chunks.size(); ++i)
+        {
+            if((chunks[i].length < 4)
+                || !read_at(file, chunks[i].offset + chunks[i].length - 4, buf, 4)
+                || (std::memcmp(buf, SYNC_FLUSH_END, 4) != 0))
+            {
+                return false;
+            }
+        }
+
+        if(!read_at(file, chunks.back().offset + chunks.back().length - 4, buf, 4))
+        {
+            return false;
+        }
+        adler = load_be32(buf);
+
+        size_t filtered_len = 0;
+        for(uint32_t len : stripe_lengths) { filtered_len += len; }
+        if((stripe_lengths.size() != chunks.size())
+            || (filtered_len != ((static_cast<size_t>(width) * 4) + 1) * static_cast<size_t>(height)))
+        {
+            stripe_lengths.clear();
+        }
+        return true;
+    }
+
+    // Inflates all of 'src' onto the end of 'dst', stopping at every block end
+    // so the position of the stream is known afterwards. Returns Z_STREAM_END
+    // once the stream ends, Z_OK otherwise.
+    static int inflate_blocks(z_stream& zs, const uint8_t* src, size_t len, std::vector<uint8_t>& dst, size_t max_len)
+    {
+        zs.next_in = const_cast<Bytef*>(src);
+        zs.avail_in = static_cast<uInt>(len);
+
+        size_t produced = dst.size();
+        while(true)
+        {
+            if(dst.size() - produced < DEFLATE_WINDOW)
+            {
+                dst.resize(produced + (4 * DEFLATE_WINDOW));
+            }
+            zs.next_out = dst.data() + produced;
+            zs.avail_out = static_cast<uInt>(dst.size() - produced);
+
+            int result = inflate(&zs, Z_BLOCK);
+            produced = dst.size() - zs.avail_out;
+            if((result != Z_OK) && (result != Z_STREAM_END) && (result != Z_BUF_ERROR))
+            {
+                result = Z_DATA_ERROR;
+            }
+            if((result == Z_DATA_ERROR) || (produced > max_len))
+            {
+                dst.resize(produced);
+                return Z_DATA_ERROR;
+            }
+            if((result == Z_STREAM_END) || ((zs.avail_in == 0) && (zs.avail_out > 0)))
+            {
+                dst.resize(produced);
+                return (result == Z_STREAM_END) ? Z_STREAM_END : Z_OK;
+            }
+        }
+    }
+
+    // Raw deflate of 'src', ending on a sync flush unless it is the last stripe
+    static void deflate_stripe(
+        const std::vector<uint8_t>& src,
+        int level,
+        bool last,
+        std::vector<uint8_t>& dst)
+    {
+        z_stream zs = { };
+        if(deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            throw std::runtime_error("zlib initialization failed");
+        }
+
+        size_t header_len = dst.size();
+        dst.resize(header_len + deflateBound(&zs, static_cast<uLong>(src.size())) + 16);
+        zs.next_in = const_cast<Bytef*>(src.data());
+        zs.avail_in = static_cast<uInt>(src.size());
+        zs.next_out = dst.data() + header_len;
+        zs.avail_out = static_cast<uInt>(dst.size() - header_len);
+
+        const int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+        while(true)
+        {
+            int result = deflate(&zs, flush);
+            if(result == Z_STREAM_ERROR)
+            {
+                deflateEnd(&zs);
+                throw std::runtime_error("zlib compression failed");
+            }
+
+            bool done = last
+                ? (result == Z_STREAM_END)
+                : ((zs.avail_in == 0) && (zs.avail_out > 0));
+            if(done) { break; }
+
+            size_t used = dst.size() - zs.avail_out;
+            dst.resize(dst.size() * 2);
+            zs.next_out = dst.data() + used;
+            zs.avail_out = static_cast<uInt>(dst.size() - used);
+        }
+
+        dst.resize(dst.size() - zs.avail_out);
+        deflateEnd(&zs);
+    }
+
+    image_writer::image_writer(
+        const std::string& fname,
+        int width,
+        int height,
+        image_save_options opt)
+        : _fname(fname)
+        , _width(width)
+        , _height(height)
+        , _compression_level(std::clamp(opt.png_compression_level, 0, 9))
+        , _thread_count(opt.png_thread_count)
+        , _filter_selection(opt.png_filter_choice)
+        , _fixed_filter(opt.png_fixed_filter)
+    {
+        _file = std::fopen(fname.c_str(), "wb");
+        if(_file == nullptr)
+        {
+            throw std::invalid_argument(
+                std::string("Unable to save png image file: [") + fname + "]"
+            );
+        }
+        start();
+    }
+
+    image_writer::image_writer(
+        std::vector<uint8_t>& dst,
+        int width,
+        int height,
+        image_save_options opt)
+        : _buffer(&dst)
+        , _width(width)
+        , _height(height)
+        , _compression_level(std::clamp(opt.png_compression_level, 0, 9))
+        , _thread_count(opt.png_thread_count)
+        , _filter_selection(opt.png_filter_choice)
+        , _fixed_filter(opt.png_fixed_filter)
+    {
+        _buffer->clear();
+        start();
+    }
+
+    image_writer::~image_writer()
+    {
+        if(_file != nullptr)
+        {
+            // Incomplete images are not left behind
+            std::fclose(_file);
+            std::remove(_fname.c_str());
+        }
+        else if((_buffer != nullptr) && !_finished)
+        {
+            _buffer->clear();
+        }
+    }
+
+    void image_writer::start()
+    {
+        _prev_row.assign(static_cast<size_t>(_width) * 4, 0);
+
+        uint8_t ihdr[13];
+        store_be32(ihdr, static_cast<uint32_t>(_width));
+        store_be32(ihdr + 4, static_cast<uint32_t>(_height));
+        ihdr[8] = 8;    // Bit depth
+        ihdr[9] = 6;    // RGBA
+        ihdr[10] = 0;   // Deflate
+        ihdr[11] = 0;   // Adaptive filtering
+        ihdr[12] = 0;   // No interlace
+
+        write_bytes(PNG_SIGNATURE, 8);
+        write_chunk("IHDR", ihdr, 13);
+    }
+
+    int image_writer::rows_written() const { return _rows_written; }
+
+    void image_writer::write_rows(const uint8_t* src, int row_count)
+    {
+        if(row_count > _height - _rows_written)
+        {
+            throw std::out_of_range("Writing past the last row of the image");
+        }
+
+        const size_t row_bytes = static_cast<size_t>(_width) * 4;
+        const int stripe_rows = static_cast<int>(std::max<size_t>(1, STRIPE_BYTES / row_bytes));
+        const size_t round_stripes = stripes_per_round();
+
+        int row = 0;
+        while(row < row_count)
+        {
+            // One stripe per thread at a time, so memory use stays bounded
+            std::vector<stripe> stripes;
+            while((stripes.size() < round_stripes) && (row < row_count))
+            {
+                stripe st;
+                st.src = src + (row * row_bytes);
+                st.row_count = std::min(stripe_rows, row_count - row);
+                st.first = (_rows_written + row == 0);
+                row += st.row_count;
+                st.last = (_rows_written + row == _height);
+                stripes.push_back(std::move(st));
+            }
+
+            worker_pool::shared().parallel_for(stripes.size(), [&](size_t i)
+            {
+                const uint8_t* prev_row = (i == 0)
+                    ? _prev_row.data()
+                    : stripes[i - 1].src + ((stripes[i - 1].row_count - 1) * row_bytes);
+                encode_stripe(stripes[i], stripes[i].src, prev_row);
+            });
+
+            for(const stripe& st : stripes)
+            {
+                _adler = static_cast<uint32_t>(adler32_combine(
+                    _adler, st.adler, static_cast<z_off_t>(st.filtered.size())));
+            }
+            write_stripes(stripes);
+
+            const stripe& tail = stripes.back();
+            std::memcpy(_prev_row.data(), tail.src + ((tail.row_count - 1) * row_bytes), row_bytes);
+        }
+        _rows_written += row_count;
+
+        if(_rows_written == _height)
+        {
+            finish();
+        }
+    }
+
+    void image_writer::encode_stripe(stripe& st, const uint8_t* src, const uint8_t* prev_row) const
+    {
+        const size_t row_bytes = static_cast<size_t>(_width) * 4;
+
+        if(st.first)
+        {
+            put_zlib_header(_compression_level, st.compressed);
+        }
+
+        st.filtered.resize(st.row_count * (row_bytes + 1));
+        for(int row = 0; row < st.row_count; ++row)
+        {
+            const uint8_t* cur = src + (row * row_bytes);
+            uint8_t* dst = st.filtered.data() + (row * (row_bytes + 1));
+            png_filter filter = png_select_filter(_filter_selection, _fixed_filter, cur, prev_row, row_bytes);
+            dst[0] = static_cast<uint8_t>(filter);
+            png_filter_row(filter, cur, prev_row, row_bytes, dst + 1);
+            prev_row = cur;
+        }
+        st.adler = static_cast<uint32_t>(adler32(1, st.filtered.data(), static_cast<uInt>(st.filtered.size())));
+    }
+
+    size_t image_writer::stripes_per_round() const
+    {
+        return (_thread_count == 0) ? worker_pool::shared().thread_count() : _thread_count;
+    }
+
+    void image_writer::write_stripes(std::vector<stripe>& stripes)
+    {
+        if(stripes.empty()) { return; }
+
+        // No preset dictionaries, so every stripe can be inflated on its own
+        worker_pool::shared().parallel_for(stripes.size(), [&](size_t i)
+        {
+            stripe& st = stripes[i];
+            deflate_stripe(st.filtered, _compression_level, st.last, st.compressed);
+        });
+
+        for(stripe& st : stripes)
+        {
+            if(st.last)
+            {
+                uint8_t adler_bytes[4];
+                store_be32(adler_bytes, _adler);
+                st.compressed.insert(st.compressed.end(), adler_bytes, adler_bytes + 4);
+            }
+            write_chunk("IDAT", st.compressed.data(), st.compressed.size());
+            _stripe_lengths.push_back(static_cast<uint32_t>(st.filtered.size()));
+        }
+    }
+
+    bool image_writer::patch_rows(
+        const std::string& source_fname,
+        const uint8_t* pixels,
+        int dirty_begin,
+        int dirty_end)
+    {
+        if(_rows_written != 0)
+        {
+            throw std::logic_error("Only a new image can be patched");
+        }
+
+        // Decoding the source costs more than it saves once most rows changed
+        if(static_cast<int64_t>(dirty_end - dirty_begin) * 4 > static_cast<int64_t>(_height) * 3)
+        {
+            return false;
+        }
+
+        std::unique_ptr<std::FILE, int(*)(std::FILE*)> source(
+            std::fopen(source_fname.c_str(), "rb"), &std::fclose);
+        std::vector<idat_chunk> chunks;
+        std::vector<uint32_t> stripe_lengths;
+        uint32_t source_adler = 1;
+        if((source == nullptr)
+            || !scan_idat_chunks(source.get(), _width, _height, chunks, source_adler, stripe_lengths))
+        {
+            return false;
+        }
+
+        auto throw_corrupt = [&](const char* reason)
+        {
+            throw std::invalid_argument(
+                std::string("Corrupt png image file (") + reason + "): [" + source_fname + "]"
+            );
+        };
+
+        const size_t row_bytes = static_cast<size_t>(_width) * 4;
+        const size_t filtered_row_bytes = row_bytes + 1;
+        const size_t total_bytes = filtered_row_bytes * _height;
+
+        // Filtered bytes that may differ from the source: the changed rows, and
+        // the row after them, which is filtered against the last changed one
+        size_t dirty_from = 0;
+        size_t dirty_to = 0;
+        if(dirty_begin < dirty_end)
+        {
+            dirty_from = dirty_begin * filtered_row_bytes;
+            dirty_to = std::min(dirty_end + 1, _height) * filtered_row_bytes;
+        }
+
+        const size_t round_stripes = stripes_per_round();
+        std::vector<stripe> stripes;
+        std::vector<uint8_t> compressed;
+        std::vector<uint8_t> filtered;
+        std::vector<uint8_t> filtered_row(filtered_row_bytes);
+        _adler = source_adler;
+
+        // Writes 'compressed' as it is, holding 'filtered_len' bytes
+        auto copy_compressed = [&](bool stream_end, size_t filtered_len)
+        {
+            write_stripes(stripes);
+            stripes.clear();
+
+            if(stream_end)
+            {
+                store_be32(compressed.data() + compressed.size() - 4, _adler);
+            }
+            write_chunk("IDAT", compressed.data(), compressed.size());
+            _stripe_lengths.push_back(static_cast<uint32_t>(filtered_len));
+        };
+
+        // Filters the changed rows in 'filtered', found at 'offset', from the
+        // new pixels and queues it to be compressed again
+        auto recompress = [&](size_t offset, bool has_zlib_header, bool stream_end)
+        {
+            const uint32_t old_adler = static_cast<uint32_t>(
+                adler32(1, filtered.data(), static_cast<uInt>(filtered.size())));
+
+            const size_t segment_end = offset + filtered.size();
+            const size_t refilter_end = std::min(segment_end, dirty_to);
+            for(size_t row = std::max(offset, dirty_from) / filtered_row_bytes;
+                row * filtered_row_bytes < refilter_end;
+                ++row)
+            {
+                const uint8_t* cur = pixels + (row * row_bytes);
+                const uint8_t* prev_row = (row == 0) ? _prev_row.data() : (cur - row_bytes);
+                png_filter filter = png_select_filter(_filter_selection, _fixed_filter, cur, prev_row, row_bytes);
+                filtered_row[0] = static_cast<uint8_t>(filter);
+                png_filter_row(filter, cur, prev_row, row_bytes, filtered_row.data() + 1);
+
+                const size_t row_start = row * filtered_row_bytes;
+                const size_t from = std::max(row_start, offset);
+                const size_t to = std::min(row_start + filtered_row_bytes, refilter_end);
+                std::memcpy(filtered.data() + (from - offset), filtered_row.data() + (from - row_start), to - from);
+            }
+
+            const uint32_t new_adler = static_cast<uint32_t>(
+                adler32(1, filtered.data(), static_cast<uInt>(filtered.size())));
+            _adler = adler32_replace(_adler, old_adler, new_adler, total_bytes - segment_end);
+
+            for(size_t from = 0; from < filtered.size(); from += STRIPE_BYTES)
+            {
+                const size_t to = std::min(from + STRIPE_BYTES, filtered.size());
+                stripe st;
+                st.first = has_zlib_header && (from == 0);
+                st.last = stream_end && (to == filtered.size());
+                if(st.first)
+                {
+                    put_zlib_header(_compression_level, st.compressed);
+                }
+                st.filtered.assign(filtered.begin() + from, filtered.begin() + to);
+                stripes.push_back(std::move(st));
+
+                if(stripes.size() == round_stripes)
+                {
+                    write_stripes(stripes);
+                    stripes.clear();
+                }
+            }
+        };
+
+        auto read_chunk = [&](const idat_chunk& chunk, size_t at)
+        {
+            compressed.resize(at + chunk.length);
+            if(!read_at(source.get(), chunk.offset, compressed.data() + at, chunk.length))
+            {
+                throw_corrupt("truncated file");
+            }
+        };
+
+        if(!stripe_lengths.empty())
+        {
+            // Stripes decode on their own: only those holding changed bytes are
+            // inflated, everything else is copied
+            size_t offset = 0;
+            for(size_t i = 0; i < chunks.size(); ++i)
+            {
+                const size_t len = stripe_lengths[i];
+                const bool last = (i + 1 == chunks.size());
+                read_chunk(chunks[i], 0);
+
+                if((offset + len <= dirty_from) || (offset >= dirty_to))
+                {
+                    copy_compressed(last, len);
+                }
+                else
+                {
+                    filtered.resize(len);
+                    if(!inflate_png_stripe(compressed.data(), compressed.size(), i == 0, last, filtered.data(), len))
+                    {
+                        throw_corrupt("bad image data");
+                    }
+                    recompress(offset, i == 0, last);
+                }
+                offset += len;
+            }
+            write_stripes(stripes);
+
+            _rows_written = _height;
+            finish();
+            return true;
+        }
+
+        // Otherwise stripes may refer back to the previous one, so the source is
+        // decoded from the start up to a window past the changed bytes, in
+        // segments ending on a byte aligned block boundary
+        _striped = false;
+        const size_t copy_from = (dirty_to == 0) ? 0 : (dirty_to + DEFLATE_WINDOW);
+
+        z_stream zs = { };
+        if(inflateInit(&zs) != Z_OK)
+        {
+            throw std::runtime_error("zlib initialization failed");
+        }
+        std::unique_ptr<z_stream, int(*)(z_streamp)> inflater(&zs, &inflateEnd);
+
+        size_t offset = 0;
+        size_t chunk_idx = 0;
+        while((chunk_idx < chunks.size()) && (offset < copy_from))
+        {
+            const bool has_zlib_header = (chunk_idx == 0);
+            compressed.clear();
+            filtered.clear();
+            bool stream_end = false;
+            bool at_boundary = false;
+            while(!stream_end && !at_boundary)
+            {
+                if(chunk_idx == chunks.size()) { throw_corrupt("missing image data"); }
+
+                const size_t from = compressed.size();
+                const idat_chunk& chunk = chunks[chunk_idx++];
+                read_chunk(chunk, from);
+
+                int result = inflate_blocks(zs, compressed.data() + from, chunk.length, filtered, total_bytes - offset);
+                if(result == Z_DATA_ERROR) { throw_corrupt("bad image data"); }
+
+                stream_end = (result == Z_STREAM_END);
+                at_boundary = ((zs.data_type & 128) != 0) && ((zs.data_type & 127) == 0);
+            }
+            if(stream_end && (offset + filtered.size() != total_bytes))
+            {
+                throw_corrupt("image data size mismatch");
+            }
+
+            if(offset + filtered.size() <= dirty_from)
+            {
+                copy_compressed(stream_end, filtered.size());
+            }
+            else
+            {
+                recompress(offset, has_zlib_header, stream_end);
+            }
+            offset += filtered.size();
+        }
+        write_stripes(stripes);
+
+        // What follows only refers back to unchanged bytes
+        for(; chunk_idx < chunks.size(); ++chunk_idx)
+        {
+            read_chunk(chunks[chunk_idx], 0);
+            if(chunk_idx + 1 == chunks.size())
+            {
+                store_be32(compressed.data() + compressed.size() - 4, _adler);
+            }
+            write_chunk("IDAT", compressed.data(), compressed.size());
+        }
+
+        _rows_written = _height;
+        finish();
+        return true;
+    }
+
+    void image_writer::finish()
+    {
+        if(_striped)
+        {
+            std::vector<uint8_t> stripes = encode_png_stripes(_stripe_lengths);
+            write_chunk(PNG_STRIPES_CHUNK, stripes.data(), stripes.size());
+        }
+        write_chunk("IEND", nullptr, 0);
+        _finished = true;
+        if(_buffer != nullptr)
+        {
+            return;
+        }
+
+        int close_result = std::fclose(_file);
+        _file = nullptr;
+        if(close_result != 0)
+        {
+            throw std::invalid_argument(
+                std::string("Unable to save png image file: [") + _fname + "]"
+            );
+        }
+    }
+
+    void image_writer::write_chunk(const char* type, const uint8_t* data, size_t len)
+    {
+        uint8_t header[8];
+        store_be32(header, static_cast<uint32_t>(len));
+        std::memcpy(header + 4, type, 4);
+
+        uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+        if(len > 0)
+        {
+            crc = crc32(crc, data, static_cast<uInt>(len));
+        }
+        uint8_t footer[4];
+        store_be32(footer, static_cast<uint32_t>(crc));
+
+        write_bytes(header, 8);
+        if(len > 0) { write_bytes(data, len); }
+        write_bytes(footer, 4);
+    }
+
+    void image_writer::write_bytes(const void* src, size_t len)
+    {
+        if(_buffer != nullptr)
+        {
+            const uint8_t* bytes = static_cast<const uint8_t*>(src);
+            _buffer->insert(_buffer->end(), bytes, bytes + len);
+            return;
+        }
+
+        if(std::fwrite(src, 1, len, _file) != len)
+        {
+            throw std::invalid_argument(
+                std::string("Unable to save png image file: [") + _fname + "]"
+            );
+        }
+    }
+}
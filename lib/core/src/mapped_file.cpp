@@ -0,0 +1,150 @@
+#include <xsteg/mapped_file.hpp>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace xsteg
+{
+#ifdef _WIN32
+    mapped_file::~mapped_file()
+    {
+        if(_data != nullptr) { UnmapViewOfFile(_data); }
+        if(_mapping != nullptr) { CloseHandle(_mapping); }
+        if(_file != -1) { CloseHandle(reinterpret_cast<HANDLE>(_file)); }
+    }
+
+    std::unique_ptr<mapped_file> mapped_file::open(const std::string& fname)
+    {
+        std::unique_ptr<mapped_file> result(new mapped_file());
+        result->_fname = fname;
+
+        HANDLE file = CreateFileA(
+            fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) { return nullptr; }
+        result->_file = reinterpret_cast<intptr_t>(file);
+
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(file, &size)) { return nullptr; }
+        result->_size = static_cast<size_t>(size.QuadPart);
+        if(result->_size == 0) { return result; }
+
+        result->_mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        if(result->_mapping == nullptr) { return nullptr; }
+
+        result->_data = static_cast<uint8_t*>(MapViewOfFile(result->_mapping, FILE_MAP_COPY, 0, 0, 0));
+        if(result->_data == nullptr) { return nullptr; }
+        return result;
+    }
+
+    std::unique_ptr<mapped_file> mapped_file::create(const std::string& fname, size_t size)
+    {
+        std::unique_ptr<mapped_file> result(new mapped_file());
+        result->_fname = fname;
+        result->_size = size;
+
+        HANDLE file = CreateFileA(
+            fname.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) { return nullptr; }
+        result->_file = reinterpret_cast<intptr_t>(file);
+        if(size == 0) { return result; }
+
+        // No empty or partial file is left behind
+        auto discard = [&]() -> std::unique_ptr<mapped_file>
+        {
+            result.reset();
+            DeleteFileA(fname.c_str());
+            return nullptr;
+        };
+
+        // Extending the file allocates its clusters, failing here when the disk is full
+        const uint64_t size64 = static_cast<uint64_t>(size);
+        result->_mapping = CreateFileMappingA(
+            file, nullptr, PAGE_READWRITE,
+            static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64 & 0xFFFFFFFF), nullptr);
+        if(result->_mapping == nullptr) { return discard(); }
+
+        result->_data = static_cast<uint8_t*>(MapViewOfFile(result->_mapping, FILE_MAP_WRITE, 0, 0, size));
+        if(result->_data == nullptr) { return discard(); }
+        return result;
+    }
+#else
+    // Allocates the blocks of the first 'size' bytes, extending the file to them
+    static bool reserve_blocks(int fd, size_t size)
+    {
+    #ifdef __APPLE__
+        fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(size), 0 };
+        return (fcntl(fd, F_PREALLOCATE, &store) != -1)
+            && (ftruncate(fd, static_cast<off_t>(size)) == 0);
+    #else
+        return posix_fallocate(fd, 0, static_cast<off_t>(size)) == 0;
+    #endif
+    }
+
+    mapped_file::~mapped_file()
+    {
+        if(_data != nullptr) { munmap(_data, _size); }
+        if(_file != -1) { ::close(static_cast<int>(_file)); }
+    }
+
+    std::unique_ptr<mapped_file> mapped_file::open(const std::string& fname)
+    {
+        std::unique_ptr<mapped_file> result(new mapped_file());
+        result->_fname = fname;
+
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        if(fd == -1) { return nullptr; }
+        result->_file = fd;
+
+        struct stat st;
+        if((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) { return nullptr; }
+        result->_size = static_cast<size_t>(st.st_size);
+        if(result->_size == 0) { return result; }
+
+        void* data = mmap(nullptr, result->_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED) { return nullptr; }
+        result->_data = static_cast<uint8_t*>(data);
+        return result;
+    }
+
+    std::unique_ptr<mapped_file> mapped_file::create(const std::string& fname, size_t size)
+    {
+        std::unique_ptr<mapped_file> result(new mapped_file());
+        result->_fname = fname;
+
+        int fd = ::open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if(fd == -1) { return nullptr; }
+        result->_file = fd;
+        if(size == 0) { return result; }
+
+        // No empty or partial file is left behind
+        auto discard = [&]() -> std::unique_ptr<mapped_file>
+        {
+            result.reset();
+            ::unlink(fname.c_str());
+            return nullptr;
+        };
+
+        // A sparse file would only run out of disk once the mapped pages are
+        // written back, raising SIGBUS instead of failing here
+        if(!reserve_blocks(fd, size)) { return discard(); }
+        result->_size = size;
+
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(data == MAP_FAILED) { return discard(); }
+        result->_data = static_cast<uint8_t*>(data);
+        return result;
+    }
+#endif
+
+    const std::string& mapped_file::fname() const { return _fname; }
+    uint8_t* mapped_file::data() { return _data; }
+    size_t mapped_file::size() const { return _size; }
+}
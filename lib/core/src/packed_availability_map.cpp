@@ -0,0 +1,115 @@
+#include <xsteg/packed_availability_map.hpp>
+
+#include <cassert>
+
+namespace xsteg
+{
+    static constexpr uint16_t channel_nibble_mask(uint32_t nibble)
+    {
+        return (nibble > 8) ? 0 : static_cast<uint16_t>((1u << nibble) - 1);
+    }
+
+    static std::array<uint16_t, 256> generate_nibble_pair_masks()
+    {
+        std::array<uint16_t, 256> result = { };
+        for(uint32_t i = 0; i < 256; ++i)
+        {
+            result[i] = static_cast<uint16_t>(
+                (channel_nibble_mask(i >> 4) << 8) | channel_nibble_mask(i & 0x0Fu));
+        }
+        return result;
+    }
+
+    const std::array<uint16_t, 256> packed_availability_map::_nibble_pair_masks = 
+        generate_nibble_pair_masks();
+
+    void packed_availability_map::reset(size_t pixel_count, std::vector<uint16_t> palette)
+    {
+        assert(palette.size() <= MAX_PALETTE_SIZE);
+
+        _size = pixel_count;
+        _palette = std::move(palette);
+        _palette_masks.clear();
+        _palette_lookup.clear();
+        for(uint16_t word : _palette)
+        {
+            _palette_masks.push_back(word_mask(word));
+        }
+
+        if(_palette.empty())
+        {
+            _indices = std::vector<uint8_t>();
+            _words.assign(pixel_count, UNSET_WORD);
+        }
+        else
+        {
+            _words = std::vector<uint16_t>();
+            _indices.assign(pixel_count, 0);
+
+            _palette_lookup.assign(0x10000, 0);
+            for(size_t i = 0; i < _palette.size(); ++i)
+            {
+                _palette_lookup[_palette[i]] = static_cast<uint8_t>(i);
+            }
+        }
+    }
+
+    size_t packed_availability_map::size() const
+    {
+        return _size;
+    }
+
+    bool packed_availability_map::uses_palette() const
+    {
+        return !_palette.empty();
+    }
+
+    const std::vector<uint16_t>& packed_availability_map::palette() const
+    {
+        return _palette;
+    }
+
+    uint8_t* packed_availability_map::palette_index_data()
+    {
+        return _indices.data();
+    }
+
+    const uint8_t* packed_availability_map::palette_index_data() const
+    {
+        return _indices.data();
+    }
+
+    uint16_t* packed_availability_map::word_data()
+    {
+        return _words.data();
+    }
+
+    const uint16_t* packed_availability_map::word_data() const
+    {
+        return _words.data();
+    }
+
+    uint16_t packed_availability_map::pack(const pixel_availability& av)
+    {
+        auto nibble = [](int bits) -> uint16_t
+        {
+            assert(bits >= -1 && bits <= 8);
+            return (bits < 0) ? 0x0Fu : static_cast<uint16_t>(bits);
+        };
+        return static_cast<uint16_t>(
+            (nibble(av.r) << 12) | (nibble(av.g) << 8) | (nibble(av.b) << 4) | nibble(av.a));
+    }
+
+    pixel_availability packed_availability_map::unpack(uint16_t word)
+    {
+        auto bits = [](uint16_t nibble) -> int
+        {
+            return (nibble == 0x0Fu) ? -1 : static_cast<int>(nibble);
+        };
+        return pixel_availability(
+            bits((word >> 12) & 0x0Fu),
+            bits((word >> 8) & 0x0Fu),
+            bits((word >> 4) & 0x0Fu),
+            bits(word & 0x0Fu));
+    }
+}
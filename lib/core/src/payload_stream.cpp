@@ -0,0 +1,71 @@
+#include <xsteg/payload_stream.hpp>
+#include <xsteg/steganographer.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace xsteg
+{
+    [[noreturn]] static void throw_streamed_carrier()
+    {
+        throw std::logic_error(
+            "Payload streams need a carrier loaded whole, not streamed");
+    }
+
+    stream_encoder::stream_encoder(steganographer& steg, bool undoable)
+        : _steg(steg)
+        , _undoable(undoable)
+    {
+        if(_steg._loading == carrier_loading::streamed)
+        {
+            throw_streamed_carrier();
+        }
+    }
+
+    void stream_encoder::write(const uint8_t* data, size_t len)
+    {
+        if(_finished)
+        {
+            throw std::logic_error("Writing to a finished payload stream");
+        }
+
+        _steg.write_bits(data, 64 + (_size * 8), len * 8, _undoable);
+        _size += len;
+    }
+
+    void stream_encoder::finish()
+    {
+        if(_finished) { return; }
+
+        _steg.write_size_header((_size * 8) + 64, _undoable);
+        _finished = true;
+    }
+
+    size_t stream_encoder::size() const { return _size; }
+
+    stream_decoder::stream_decoder(steganographer& steg)
+        : _steg(steg)
+    {
+        if(_steg._loading == carrier_loading::streamed)
+        {
+            throw_streamed_carrier();
+        }
+
+        size_t bit_len = _steg.decode_size_header();
+        _steg.require_encoded_bits(bit_len);
+        _size = (bit_len / 8) - 8;
+    }
+
+    size_t stream_decoder::read(uint8_t* dst, size_t len)
+    {
+        len = std::min(len, _size - _position);
+        if(len == 0) { return 0; }
+
+        _steg.extract_payload(_position, len, dst);
+        _position += len;
+        return len;
+    }
+
+    size_t stream_decoder::size() const { return _size; }
+    size_t stream_decoder::position() const { return _position; }
+}
@@ -0,0 +1,58 @@
+#include <xsteg/png_chunks.hpp>
+
+#include <algorithm>
+
+namespace xsteg
+{
+    png_chunk_iterator::png_chunk_iterator(read_func read, size_t size)
+        : _read(std::move(read))
+        , _size(size)
+    { }
+
+    png_chunk_iterator::png_chunk_iterator(const uint8_t* data, size_t len)
+        : _data(data)
+        , _size(len)
+    { }
+
+    bool png_chunk_iterator::read_signature()
+    {
+        uint8_t signature[8];
+        if(!read_data(signature, 8)) { return false; }
+        return std::memcmp(signature, PNG_SIGNATURE, 8) == 0;
+    }
+
+    bool png_chunk_iterator::next(png_chunk& chunk)
+    {
+        if((_chunk_left > 0) && !read_data(nullptr, _chunk_left))
+        {
+            return false;
+        }
+
+        uint8_t header[8];
+        if(!read_data(header, 8)) { return false; }
+        chunk.length = load_be32(header);
+        std::memcpy(chunk.type, header + 4, 4);
+        chunk.type[4] = '\0';
+        chunk.offset = _pos;
+
+        // Data and CRC
+        _chunk_left = static_cast<size_t>(chunk.length) + 4;
+        return _chunk_left <= _size - _pos;
+    }
+
+    bool png_chunk_iterator::read_data(uint8_t* dst, size_t len)
+    {
+        if(len > _size - _pos) { return false; }
+        if(_data != nullptr)
+        {
+            if(dst != nullptr) { std::memcpy(dst, _data + _pos, len); }
+        }
+        else if(!_read(dst, len))
+        {
+            return false;
+        }
+        _pos += len;
+        _chunk_left -= std::min(_chunk_left, len);
+        return true;
+    }
+}
@@ -0,0 +1,354 @@
+#include <xsteg/png_filter.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define XSTEG_HAS_SSE2 1
+    #include <immintrin.h>
+#else
+    #define XSTEG_HAS_SSE2 0
+#endif
+
+namespace xsteg
+{
+    static const size_t RGBA_BPP = 4;
+
+    // Rows shorter than this are always scored whole
+    static const size_t MIN_SAMPLED_ROW_BYTES = 256;
+    static const size_t SAMPLE_BYTES = 16;
+    static const size_t SAMPLE_STRIDE = 64;
+
+    static inline uint8_t paeth_predictor(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = std::abs(p - a);
+        int pb = std::abs(p - b);
+        int pc = std::abs(p - c);
+        if(pa <= pb && pa <= pc) { return static_cast<uint8_t>(a); }
+        if(pb <= pc) { return static_cast<uint8_t>(b); }
+        return static_cast<uint8_t>(c);
+    }
+
+    template<png_filter F>
+    static inline uint8_t filter_byte(uint8_t x, uint8_t a, uint8_t b, uint8_t c)
+    {
+        switch(F)
+        {
+            case png_filter::sub: return static_cast<uint8_t>(x - a);
+            case png_filter::up: return static_cast<uint8_t>(x - b);
+            case png_filter::average: return static_cast<uint8_t>(x - ((a + b) >> 1));
+            case png_filter::paeth: return static_cast<uint8_t>(x - paeth_predictor(a, b, c));
+            default: return x;
+        }
+    }
+
+    template<png_filter F>
+    static inline uint8_t filter_byte_at(const uint8_t* row, const uint8_t* prev, size_t i)
+    {
+        uint8_t a = (i >= RGBA_BPP) ? row[i - RGBA_BPP] : 0;
+        uint8_t c = (i >= RGBA_BPP) ? prev[i - RGBA_BPP] : 0;
+        return filter_byte<F>(row[i], a, prev[i], c);
+    }
+
+#if XSTEG_HAS_SSE2
+    static inline __m128i load16(const uint8_t* p) 
+    { 
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); 
+    }
+
+    static inline void store16(uint8_t* p, __m128i v) 
+    { 
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); 
+    }
+
+    static inline __m128i load4(const uint8_t* p)
+    {
+        int32_t val;
+        std::memcpy(&val, p, 4);
+        return _mm_cvtsi32_si128(val);
+    }
+
+    static inline void store4(uint8_t* p, __m128i v)
+    {
+        int32_t val = _mm_cvtsi128_si32(v);
+        std::memcpy(p, &val, 4);
+    }
+
+    static inline __m128i select(__m128i mask, __m128i if_set, __m128i if_clear)
+    {
+        return _mm_or_si128(_mm_and_si128(mask, if_set), _mm_andnot_si128(mask, if_clear));
+    }
+
+    static inline __m128i abs_epi16(__m128i v)
+    {
+        return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+    }
+
+    // Floor of (a + b) / 2 for every byte
+    static inline __m128i avg_floor_epu8(__m128i a, __m128i b)
+    {
+        __m128i round_bit = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+        return _mm_sub_epi8(_mm_avg_epu8(a, b), round_bit);
+    }
+
+    // Paeth predictor of bytes widened to 16 bit lanes
+    static inline __m128i paeth_epi16(__m128i a, __m128i b, __m128i c)
+    {
+        __m128i pa = abs_epi16(_mm_sub_epi16(b, c));
+        __m128i pb = abs_epi16(_mm_sub_epi16(a, c));
+        __m128i pc = abs_epi16(_mm_sub_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, c)));
+        __m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+        __m128i not_b = _mm_cmpgt_epi16(pb, pc);
+        return select(not_a, select(not_b, c, b), a);
+    }
+
+    static inline __m128i paeth_epu8(__m128i a, __m128i b, __m128i c)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i lo = paeth_epi16(
+            _mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+        __m128i hi = paeth_epi16(
+            _mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    // Filters the 16 bytes at 'i', which must be past the first pixel
+    template<png_filter F>
+    static inline __m128i filter16(const uint8_t* row, const uint8_t* prev, size_t i)
+    {
+        __m128i x = load16(row + i);
+        switch(F)
+        {
+            case png_filter::sub: return _mm_sub_epi8(x, load16(row + i - RGBA_BPP));
+            case png_filter::up: return _mm_sub_epi8(x, load16(prev + i));
+            case png_filter::average: 
+                return _mm_sub_epi8(x, avg_floor_epu8(load16(row + i - RGBA_BPP), load16(prev + i)));
+            case png_filter::paeth: 
+                return _mm_sub_epi8(x, paeth_epu8(
+                    load16(row + i - RGBA_BPP), load16(prev + i), load16(prev + i - RGBA_BPP)));
+            default: return x;
+        }
+    }
+
+    // Sum of the absolute values of the bytes, read as signed
+    static inline __m128i abs_sum_epi8(__m128i v)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i abs = _mm_min_epu8(v, _mm_sub_epi8(zero, v));
+        return _mm_sad_epu8(abs, zero);
+    }
+#endif
+
+    template<png_filter F>
+    static void filter_row(const uint8_t* row, const uint8_t* prev, size_t len, uint8_t* dst)
+    {
+        size_t i = 0;
+        for(; (i < len) && (i < RGBA_BPP); ++i)
+        {
+            dst[i] = filter_byte_at<F>(row, prev, i);
+        }
+#if XSTEG_HAS_SSE2
+        for(; i + 16 <= len; i += 16)
+        {
+            store16(dst + i, filter16<F>(row, prev, i));
+        }
+#endif
+        for(; i < len; ++i)
+        {
+            dst[i] = filter_byte_at<F>(row, prev, i);
+        }
+    }
+
+    // Sum of absolute filtered values of the bytes in [from, to)
+    template<png_filter F>
+    static uint64_t filter_score(const uint8_t* row, const uint8_t* prev, size_t from, size_t to)
+    {
+        uint64_t score = 0;
+        size_t i = from;
+        for(; (i < to) && (i < RGBA_BPP); ++i)
+        {
+            score += std::abs(static_cast<int8_t>(filter_byte_at<F>(row, prev, i)));
+        }
+#if XSTEG_HAS_SSE2
+        __m128i sums = _mm_setzero_si128();
+        for(; i + 16 <= to; i += 16)
+        {
+            sums = _mm_add_epi64(sums, abs_sum_epi8(filter16<F>(row, prev, i)));
+        }
+        uint64_t lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums);
+        score += lanes[0] + lanes[1];
+#endif
+        for(; i < to; ++i)
+        {
+            score += std::abs(static_cast<int8_t>(filter_byte_at<F>(row, prev, i)));
+        }
+        return score;
+    }
+
+    template<png_filter F>
+    static uint64_t filter_score(const uint8_t* row, const uint8_t* prev, size_t len, bool sampled)
+    {
+        if(!sampled || (len < MIN_SAMPLED_ROW_BYTES))
+        {
+            return filter_score<F>(row, prev, 0, len);
+        }
+
+        uint64_t score = 0;
+        for(size_t i = 0; i + SAMPLE_BYTES <= len; i += SAMPLE_STRIDE)
+        {
+            score += filter_score<F>(row, prev, i, i + SAMPLE_BYTES);
+        }
+        return score;
+    }
+
+    void png_filter_row(
+        png_filter filter, 
+        const uint8_t* row, 
+        const uint8_t* prev, 
+        size_t len, 
+        uint8_t* dst)
+    {
+        switch(filter)
+        {
+            case png_filter::none: { std::memcpy(dst, row, len); break; }
+            case png_filter::sub: { filter_row<png_filter::sub>(row, prev, len, dst); break; }
+            case png_filter::up: { filter_row<png_filter::up>(row, prev, len, dst); break; }
+            case png_filter::average: { filter_row<png_filter::average>(row, prev, len, dst); break; }
+            case png_filter::paeth: { filter_row<png_filter::paeth>(row, prev, len, dst); break; }
+        }
+    }
+
+    png_filter png_select_filter(
+        png_filter_selection selection,
+        png_filter fixed_filter,
+        const uint8_t* row,
+        const uint8_t* prev,
+        size_t len)
+    {
+        if(selection == png_filter_selection::fixed) { return fixed_filter; }
+
+        const bool sampled = (selection == png_filter_selection::sampled);
+        const uint64_t scores[5] = 
+        {
+            filter_score<png_filter::none>(row, prev, len, sampled),
+            filter_score<png_filter::sub>(row, prev, len, sampled),
+            filter_score<png_filter::up>(row, prev, len, sampled),
+            filter_score<png_filter::average>(row, prev, len, sampled),
+            filter_score<png_filter::paeth>(row, prev, len, sampled)
+        };
+
+        size_t best = 0;
+        for(size_t i = 1; i < 5; ++i)
+        {
+            if(scores[i] < scores[best]) { best = i; }
+        }
+        return static_cast<png_filter>(best);
+    }
+
+    static void unfilter_sub(uint8_t* row, size_t len, size_t bpp)
+    {
+        size_t i = bpp;
+#if XSTEG_HAS_SSE2
+        if(bpp == RGBA_BPP)
+        {
+            // Prefix sum of the pixels of each 16 bytes, plus the last pixel before them
+            __m128i last = _mm_setzero_si128();
+            for(i = 0; i + 16 <= len; i += 16)
+            {
+                __m128i x = load16(row + i);
+                x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+                x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+                x = _mm_add_epi8(x, last);
+                store16(row + i, x);
+                last = _mm_shuffle_epi32(x, 0xFF);
+            }
+            i = std::max(i, bpp);
+        }
+#endif
+        for(; i < len; ++i) { row[i] += row[i - bpp]; }
+    }
+
+    static void unfilter_up(uint8_t* row, const uint8_t* prev, size_t len)
+    {
+        size_t i = 0;
+#if XSTEG_HAS_SSE2
+        for(; i + 16 <= len; i += 16)
+        {
+            store16(row + i, _mm_add_epi8(load16(row + i), load16(prev + i)));
+        }
+#endif
+        for(; i < len; ++i) { row[i] += prev[i]; }
+    }
+
+    static void unfilter_average(uint8_t* row, const uint8_t* prev, size_t len, size_t bpp)
+    {
+        size_t i = 0;
+#if XSTEG_HAS_SSE2
+        if(bpp == RGBA_BPP)
+        {
+            // One pixel at a time, each depends on the one before
+            __m128i a = _mm_setzero_si128();
+            for(; i + RGBA_BPP <= len; i += RGBA_BPP)
+            {
+                a = _mm_add_epi8(load4(row + i), avg_floor_epu8(a, load4(prev + i)));
+                store4(row + i, a);
+            }
+            return;
+        }
+#endif
+        for(; i < bpp; ++i) { row[i] += prev[i] >> 1; }
+        for(; i < len; ++i)
+        {
+            row[i] += static_cast<uint8_t>((row[i - bpp] + prev[i]) >> 1);
+        }
+    }
+
+    static void unfilter_paeth(uint8_t* row, const uint8_t* prev, size_t len, size_t bpp)
+    {
+        size_t i = 0;
+#if XSTEG_HAS_SSE2
+        if(bpp == RGBA_BPP)
+        {
+            // One pixel at a time in 16 bit lanes, each depends on the one before
+            const __m128i zero = _mm_setzero_si128();
+            __m128i a = zero;
+            __m128i c = zero;
+            for(; i + RGBA_BPP <= len; i += RGBA_BPP)
+            {
+                __m128i b = _mm_unpacklo_epi8(load4(prev + i), zero);
+                __m128i x = _mm_unpacklo_epi8(load4(row + i), zero);
+                a = _mm_and_si128(_mm_add_epi16(x, paeth_epi16(a, b, c)), _mm_set1_epi16(0xFF));
+                store4(row + i, _mm_packus_epi16(a, zero));
+                c = b;
+            }
+            return;
+        }
+#endif
+        for(; i < bpp; ++i) { row[i] += prev[i]; }
+        for(; i < len; ++i)
+        {
+            row[i] += paeth_predictor(row[i - bpp], prev[i], prev[i - bpp]);
+        }
+    }
+
+    bool png_unfilter_row(
+        uint8_t filter_type, 
+        uint8_t* row, 
+        const uint8_t* prev, 
+        size_t len, 
+        size_t bpp)
+    {
+        switch(filter_type)
+        {
+            case 0: return true;
+            case 1: { unfilter_sub(row, len, bpp); return true; }
+            case 2: { unfilter_up(row, prev, len); return true; }
+            case 3: { unfilter_average(row, prev, len, bpp); return true; }
+            case 4: { unfilter_paeth(row, prev, len, bpp); return true; }
+            default: return false;
+        }
+    }
+}
@@ -0,0 +1,190 @@
+#include <xsteg/png_stripes.hpp>
+
+#include <xsteg/png_chunks.hpp>
+#include <xsteg/png_filter.hpp>
+#include <xsteg/worker_pool.hpp>
+
+#include <zlib.h>
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+namespace xsteg
+{
+    // Deflate can not expand data more than this, so a stripe claiming more
+    // filtered bytes is corrupt (and must not get to allocate them)
+    static const size_t MAX_INFLATE_RATIO = 1032;
+
+    std::vector<uint8_t> encode_png_stripes(const std::vector<uint32_t>& filtered_lengths)
+    {
+        std::vector<uint8_t> result(filtered_lengths.size() * 4);
+        for(size_t i = 0; i < filtered_lengths.size(); ++i)
+        {
+            store_be32(result.data() + (i * 4), filtered_lengths[i]);
+        }
+        return result;
+    }
+
+    bool decode_png_stripes(const uint8_t* payload, size_t len, std::vector<uint32_t>& filtered_lengths)
+    {
+        if((len % 4) != 0) { return false; }
+
+        filtered_lengths.clear();
+        for(size_t i = 0; i < len; i += 4)
+        {
+            filtered_lengths.push_back(load_be32(payload + i));
+        }
+        return true;
+    }
+
+    bool inflate_png_stripe(
+        const uint8_t* src,
+        size_t len,
+        bool first,
+        bool last,
+        uint8_t* dst,
+        size_t dst_len)
+    {
+        if(first)
+        {
+            // zlib header: deflate, no preset dictionary
+            if((len < 2) || ((src[0] & 0x0F) != 8) || ((src[1] & 0x20) != 0)
+                || ((((src[0] << 8) | src[1]) % 31) != 0))
+            {
+                return false;
+            }
+            src += 2;
+            len -= 2;
+        }
+
+        z_stream zs = { };
+        if(inflateInit2(&zs, -15) != Z_OK)
+        {
+            return false;
+        }
+        zs.next_in = const_cast<Bytef*>(src);
+        zs.avail_in = static_cast<uInt>(len);
+        zs.next_out = dst;
+        zs.avail_out = static_cast<uInt>(dst_len);
+
+        int result = inflate(&zs, Z_SYNC_FLUSH);
+        bool ok = (zs.avail_out == 0)
+               && (last ? (result == Z_STREAM_END) : ((result == Z_OK) && (zs.avail_in == 0)));
+        inflateEnd(&zs);
+        return ok;
+    }
+
+    striped_png::striped_png(const uint8_t* data, size_t len)
+    {
+        png_chunk_iterator chunks(data, len);
+        if(!chunks.read_signature())
+        {
+            return;
+        }
+
+        bool header_ok = false;
+        std::vector<uint32_t> filtered_lengths;
+        png_chunk chunk;
+        while(chunks.next(chunk))
+        {
+            const uint8_t* payload = data + chunk.offset;
+            if(chunk.is("IHDR"))
+            {
+                header_ok = (chunk.length == 13)
+                         && (payload[8] == 8) && (payload[9] == 6)
+                         && (payload[10] == 0) && (payload[11] == 0) && (payload[12] == 0);
+                const uint32_t width = load_be32(payload);
+                const uint32_t height = load_be32(payload + 4);
+                header_ok = header_ok
+                         && (width > 0) && (height > 0)
+                         && (width <= PNG_MAX_DIMENSION) && (height <= PNG_MAX_DIMENSION);
+                _width = header_ok ? static_cast<int>(width) : 0;
+                _height = header_ok ? static_cast<int>(height) : 0;
+            }
+            else if(chunk.is("IDAT"))
+            {
+                stripe st;
+                st.data = payload;
+                st.len = chunk.length;
+                _stripes.push_back(st);
+            }
+            else if(chunk.is(PNG_STRIPES_CHUNK))
+            {
+                if(!decode_png_stripes(payload, chunk.length, filtered_lengths))
+                {
+                    break;
+                }
+            }
+            else if(chunk.is("IEND"))
+            {
+                break;
+            }
+        }
+
+        size_t filtered_offset = 0;
+        bool lengths_ok = header_ok && !_stripes.empty() && (filtered_lengths.size() == _stripes.size());
+        for(size_t i = 0; lengths_ok && (i < _stripes.size()); ++i)
+        {
+            lengths_ok = (filtered_lengths[i] <= _stripes[i].len * MAX_INFLATE_RATIO);
+            _stripes[i].filtered_offset = filtered_offset;
+            _stripes[i].filtered_len = filtered_lengths[i];
+            filtered_offset += filtered_lengths[i];
+        }
+
+        const size_t row_bytes = static_cast<size_t>(_width) * 4;
+        if(!lengths_ok || (filtered_offset != (row_bytes + 1) * static_cast<size_t>(_height)))
+        {
+            _stripes.clear();
+        }
+    }
+
+    bool striped_png::is_striped() const
+    {
+        return !_stripes.empty();
+    }
+
+    int striped_png::width() const { return _width; }
+    int striped_png::height() const { return _height; }
+
+    bool striped_png::decode(uint8_t* dst) const
+    {
+        const size_t row_bytes = static_cast<size_t>(_width) * 4;
+
+        // Every byte is written by the stripe holding it
+        std::unique_ptr<uint8_t[]> filtered(new uint8_t[(row_bytes + 1) * static_cast<size_t>(_height)]);
+
+        std::atomic<bool> ok { true };
+        worker_pool::shared().parallel_for(_stripes.size(), [&](size_t i)
+        {
+            const stripe& st = _stripes[i];
+            if(!inflate_png_stripe(
+                st.data,
+                st.len,
+                i == 0,
+                i + 1 == _stripes.size(),
+                filtered.get() + st.filtered_offset,
+                st.filtered_len))
+            {
+                ok = false;
+            }
+        });
+        if(!ok) { return false; }
+
+        // Every row is restored from the one above it
+        std::vector<uint8_t> zero_row(row_bytes, 0);
+        const uint8_t* prev_row = zero_row.data();
+        for(int row = 0; row < _height; ++row)
+        {
+            const uint8_t* src = filtered.get() + (row * (row_bytes + 1));
+            uint8_t* dst_row = dst + (row * row_bytes);
+            std::memcpy(dst_row, src + 1, row_bytes);
+            if(!png_unfilter_row(src[0], dst_row, prev_row, row_bytes, 4))
+            {
+                return false;
+            }
+            prev_row = dst_row;
+        }
+        return true;
+    }
+}
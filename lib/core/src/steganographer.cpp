@@ -1,21 +1,63 @@
 #include <xsteg/steganographer.hpp>
 
-#include <xsteg/bit_tools.hpp>
-#include <xsteg/bit_view.hpp>
+#include <xsteg/bit_reader.hpp>
+#include <xsteg/bit_writer.hpp>
+#include <xsteg/image_reader.hpp>
+#include <xsteg/image_writer.hpp>
+#include <xsteg/pixel_bits.hpp>
+#include <xsteg/threshold_engine.hpp>
+#include <xsteg/worker_pool.hpp>
 
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <limits>
 #include <sstream>
+#include <stdexcept>
 
 namespace xsteg
 {
-    steganographer::steganographer(const std::string& fname)
-        : _img(std::make_unique<image>(fname))
+    steganographer::steganographer(const std::string& fname, carrier_loading loading)
+        : _fname(fname)
+        , _loading(loading)
+    {
+        if(_loading == carrier_loading::whole)
+        {
+            _img = std::make_unique<image>(fname);
+
+            std::error_code ec;
+            _source_time = std::filesystem::last_write_time(fname, ec);
+            _source_size = std::filesystem::file_size(fname, ec);
+        }
+        else
+        {
+            // Only the header is read until the first pass
+            _reader = std::make_unique<image_reader>(fname);
+        }
+        _av_map = std::make_unique<availability_map>(_img.get());
+    }
+
+    steganographer::steganographer(const uint8_t* encoded_data, size_t len)
+        : _img(std::make_unique<image>(encoded_data, len))
+    {
+        _av_map = std::make_unique<availability_map>(_img.get());
+    }
+
+    steganographer::steganographer(image&& img)
+        : _img(std::make_unique<image>(std::move(img)))
     {
         _av_map = std::make_unique<availability_map>(_img.get());
     }
 
+    steganographer::steganographer(std::FILE* stream)
+        : _loading(carrier_loading::streamed)
+        , _reader(std::make_unique<image_reader>(stream))
+    {
+        _av_map = std::make_unique<availability_map>(nullptr);
+    }
+
+    steganographer::~steganographer() = default;
+
     void steganographer::add_threshold(
         visual_data_type type, 
         threshold_direction dir, 
@@ -32,14 +74,24 @@ namespace xsteg
 
     size_t steganographer::available_space_bits()
     {
-        _av_map->apply_thresholds();
-        return _av_map->available_data_space();
+        if(_loading == carrier_loading::streamed)
+        {
+            return _av_map->count_data_space(*open_reader());
+        }
+        return _av_map->count_data_space();
     }
 
     void steganographer::restore_key(const std::string& key)
     {
         _av_map->restore_from_key(key);
-        _av_map->apply_thresholds();
+    }
+
+    static const size_t MIN_BITS_PER_WORKER = (size_t)1 << 20;
+
+    static size_t worker_count(size_t bit_count)
+    {
+        return std::clamp<size_t>(
+            bit_count / MIN_BITS_PER_WORKER, 1, worker_pool::shared().thread_count());
     }
 
     std::vector<uint8_t> get_bytes_for_size(size_t sz)
@@ -56,9 +108,8 @@ namespace xsteg
         return result;
     }
 
-    size_t get_size_from_bytes(const std::vector<uint8_t>& data)
+    size_t get_size_from_bytes(const uint8_t* data)
     {
-        assert(data.size() >= 8);
         size_t result = 0;
         for(size_t i = 0; i < 8; ++i)
         {
@@ -68,207 +119,555 @@ namespace xsteg
         return result;
     }
 
-    std::vector<uint8_t> get_size_bytes_from_bits(const std::vector<bool>& data)
+    [[noreturn]] static void throw_invalid_header()
     {
-        std::vector<uint8_t> result;
-        result.resize(8, 0x00u);
-        size_t current_bit = 0;
+        throw std::invalid_argument(
+            "Invalid size header! The thresholds do not match the encoded data.");
+    }
 
-        while (current_bit < 64)
-        {
-            size_t bit = static_cast<size_t>(data[current_bit] ? 1 : 0);
-            size_t mask = bit << (7 - (current_bit%8));
+    [[noreturn]] static void throw_not_enough_space(size_t bit_len, size_t available_space)
+    {
+        std::stringstream ss;
+        ss << "Not enough available space to encode data! "
+           << "Requested [" 
+           << bit_len
+           << "]b to encode, while maximum allowed space is [" 
+           << available_space 
+           << "]b for the given destination and thresholds.";
+        throw std::overflow_error(ss.str());
+    }
 
-            size_t byte_idx = current_bit / 8;
-            result[byte_idx] |= mask;
+    [[noreturn]] static void throw_offset_past_end(size_t offset, size_t byte_count)
+    {
+        std::stringstream ss;
+        ss << "Read offset [" << offset << "] is past the end of the encoded data ["
+           << byte_count << "]b.";
+        throw std::out_of_range(ss.str());
+    }
+
+    // Embeds the next data bits into the pixel bits selected by 'mask', which
+    // hold data bits from 'begin_bit' on. Only bits in [from_bit, to_bit) are
+    // written, the others keep their original value.
+    static inline void embed_pixel(
+        uint8_t* pxptr, 
+        uint32_t mask, 
+        bit_reader& bits, 
+        size_t begin_bit, 
+        size_t from_bit, 
+        size_t to_bit)
+    {
+        const size_t count = popcount32(mask);
+        const size_t end_bit = begin_bit + count;
+        const uint32_t word = load_pixel_word(pxptr);
+        uint32_t val;
 
-            ++current_bit;
+        if((begin_bit >= from_bit) && (end_bit <= to_bit))
+        {
+            val = bits.read(count);
         }
-        return result;
+        else
+        {
+            size_t leading = (from_bit > begin_bit) ? (from_bit - begin_bit) : 0;
+            size_t trailing = (end_bit > to_bit) ? (end_bit - to_bit) : 0;
+            size_t written = count - leading - trailing;
+            uint32_t written_mask = static_cast<uint32_t>(((uint64_t(1) << written) - 1) << trailing);
+            val = (extract_pixel_bits(word, mask) & ~written_mask) | (bits.read(written) << trailing);
+        }
+
+        store_pixel_word(pxptr, (word & ~mask) | deposit_pixel_bits(val, mask));
     }
 
-    void steganographer::write_data(uint8_t* data, size_t len)
+    // Writes the 'count' bits of a pixel, starting at data bit 'begin_bit', that
+    // fall in [from_bit, to_bit)
+    static inline void write_bit_range(
+        bit_writer& writer, 
+        uint32_t bits, 
+        size_t begin_bit, 
+        size_t count, 
+        size_t from_bit, 
+        size_t to_bit)
     {
-        _av_map->apply_thresholds();
+        size_t end_bit = begin_bit + count;
+        if((end_bit <= from_bit) || (begin_bit >= to_bit)) { return; }
 
-        size_t bit_len = ((len * 8) + 64);
-        std::vector<uint8_t> size_data = get_bytes_for_size(bit_len);
+        size_t leading = (from_bit > begin_bit) ? (from_bit - begin_bit) : 0;
+        size_t trailing = (end_bit > to_bit) ? (end_bit - to_bit) : 0;
+        writer.write(bits >> trailing, count - leading - trailing);
+    }
 
-        std::vector<uint8_t> inter_data;
-        inter_data.resize(len + 8, 0x00u);
+    void steganographer::write_data(uint8_t* data, size_t len)
+    {
+        size_t bit_len = ((len * 8) + 64);
 
-        std::memcpy(inter_data.data(), size_data.data(), 8);
-        std::memcpy(inter_data.data() + 8, data, len);
+        if(_loading == carrier_loading::streamed)
+        {
+            // Embedded while the image is written, only check that it fits.
+            // Streams can only be read once, so they are checked while saving.
+            if(!_fname.empty())
+            {
+                size_t available_space = _av_map->count_data_space(*open_reader(), bit_len);
+                if(available_space < bit_len)
+                {
+                    throw_not_enough_space(bit_len, available_space);
+                }
+            }
+            std::vector<uint8_t> size_data = get_bytes_for_size(bit_len);
+            _pending_data.resize(len + 8);
+            std::memcpy(_pending_data.data(), size_data.data(), 8);
+            std::memcpy(_pending_data.data() + 8, data, len);
+            return;
+        }
         
-        auto& space_map = _av_map->available_map();
-        size_t available_space = _av_map->available_data_space();
+        // Nothing is written unless all of it fits
+        size_t available_space = _av_map->ensure_data_space(bit_len);
 
         if(available_space < bit_len)
         {
-            std::stringstream ss;
-            ss << "Not enough available space to encode data! "
-               << "Requested [" 
-               << bit_len
-               << "]b to encode, while maximum allowed space is [" 
-               << available_space 
-               << "]b for the given destination and thresholds.";
-            throw std::overflow_error(ss.str());
+            throw_not_enough_space(bit_len, available_space);
         }
 
-        bit_view bits(inter_data.data(), bit_len);
-        size_t report_counter = 0;
+        write_size_header(bit_len);
+        write_bits(data, 64, len * 8);
+    }
 
-        size_t current_bit = 0;
-        auto request_bits = [&](int count) -> std::vector<bool>
+    void steganographer::write_size_header(size_t bit_len, bool log_undo)
+    {
+        std::vector<uint8_t> size_data = get_bytes_for_size(bit_len);
+        write_bits(size_data.data(), 0, 64, log_undo);
+    }
+
+    void steganographer::reset()
+    {
+        if(_undo_lost)
         {
-            auto result = bits.get_bits_at(current_bit, std::max(count, 0));
-            size_t added_bits = result.size();
-            current_bit += added_bits;
-            return result;
-        };
+            throw std::logic_error(
+                "The carrier can not be restored, data was written without an undo log");
+        }
+
+        _pending_data.clear();
+        if(_undo_bits == 0)
+        {
+            return;
+        }
+
+        embed_bits(_undo_log.data(), 0, _undo_bits);
+        _undo_log.clear();
+        _undo_bits = 0;
+        _changed_px_begin = SIZE_MAX;
+        _changed_px_end = 0;
+    }
 
-        size_t cur_pixel = 0;
-        auto space_it = space_map.begin();
+    void steganographer::write_bits(const uint8_t* data, size_t first_bit, size_t bit_count, bool log_undo)
+    {
+        const size_t end_bit = first_bit + bit_count;
+        size_t available_space = _av_map->ensure_data_space(end_bit);
+        if(available_space < end_bit)
+        {
+            throw_not_enough_space(end_bit, available_space);
+        }
 
-        // Encode data
-        while(current_bit < bit_len)
+        // Carrier bits about to be written over for the first time. Writes are
+        // a whole number of bytes at byte offsets, so the log stays aligned.
+        if((end_bit > _undo_bits) && !log_undo)
         {
-            auto av_bits = *space_it;
-            uint8_t* pxptr = _img->data() + (cur_pixel * 4);
+            // The log no longer covers every changed bit, it is of no use
+            _undo_lost = true;
+            _undo_log = std::vector<uint8_t>();
+            _undo_bits = 0;
+        }
+        else if((end_bit > _undo_bits) && !_undo_lost)
+        {
+            _undo_log.resize(end_bit / 8);
+            extract_bytes(_undo_bits, (end_bit - _undo_bits) / 8, _undo_log.data() + (_undo_bits / 8));
+            _undo_bits = end_bit;
+        }
+        embed_bits(data, first_bit, bit_count);
+    }
 
-            if(!av_bits.is_useless())
-            {
-                if(av_bits.r) { set_last_bits(pxptr + 0, request_bits(std::max(av_bits.r, 0))); }
-                if(av_bits.g) { set_last_bits(pxptr + 1, request_bits(std::max(av_bits.g, 0))); }
-                if(av_bits.b) { set_last_bits(pxptr + 2, request_bits(std::max(av_bits.b, 0))); }
-                if(av_bits.a) { set_last_bits(pxptr + 3, request_bits(std::max(av_bits.a, 0))); }
-            }
+    void steganographer::embed_bits(const uint8_t* data, size_t first_bit, size_t bit_count)
+    {
+        if(bit_count == 0) { return; }
+
+        const size_t end_bit = first_bit + bit_count;
+        const size_t end_run = _av_map->find_run(end_bit - 1) + 1;
+        const size_t workers = worker_count(bit_count);
 
-            ++space_it;
-            ++cur_pixel;
+        // Each worker starts on a run boundary, so no pixel is shared
+        std::vector<size_t> bounds;
+        for(size_t i = 0; i < workers; ++i)
+        {
+            bounds.push_back(_av_map->find_run(first_bit + ((bit_count / workers) * i)));
         }
+        bounds.push_back(end_run);
+        bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+        const auto& runs = _av_map->available_runs();
+        _changed_px_begin = std::min(_changed_px_begin, runs[bounds.front()].first_px);
+        _changed_px_end = std::max(_changed_px_end, runs[end_run - 1].first_px + runs[end_run - 1].px_count);
+
+        worker_pool::shared().parallel_for(bounds.size() - 1, [&](size_t i)
+        {
+            embed_runs(data, first_bit, end_bit, bounds[i], bounds[i + 1]);
+        });
     }
 
     std::vector<uint8_t> steganographer::read_data()
     {
-        size_t init_data_px_idx = 0;
+        if(_loading == carrier_loading::streamed)
+        {
+            std::vector<uint8_t> result;
+            stream_read(0, std::numeric_limits<size_t>::max(), &result);
+            return result;
+        }
 
-        size_t bit_len = decode_size_header(init_data_px_idx);
+        size_t bit_len = decode_size_header();
+        require_encoded_bits(bit_len);
+        size_t byte_count = (bit_len / 8) - 8;
 
-        std::vector<bool> read_bits;
-        read_bits.reserve(bit_len);
+        std::vector<uint8_t> result;
+        result.resize(byte_count, 0x00u);
+        extract_payload(0, byte_count, result.data());
+        return result;
+    }
 
-        auto& space_map = _av_map->available_map();
+    void steganographer::extract_payload(size_t offset, size_t length, uint8_t* dst)
+    {
+        extract_bytes(64 + (offset * 8), length, dst);
+    }
 
-        size_t cur_pixel = 0;
-        auto space_it = space_map.begin();
+    void steganographer::extract_bytes(size_t first_bit, size_t length, uint8_t* dst)
+    {
+        // Workers extract disjoint byte ranges
+        const size_t workers = worker_count(length * 8);
+        const size_t worker_bytes = (length / workers) + 1;
 
-        size_t report_counter = 0;
-        size_t current_bit = 0;
+        worker_pool::shared().parallel_for(workers, [&](size_t i)
+        {
+            size_t from = std::min(i * worker_bytes, length);
+            size_t count = std::min(worker_bytes, length - from);
+            extract_bits(first_bit + (from * 8), count * 8, dst + from);
+        });
+    }
+
+    size_t steganographer::read_data_size()
+    {
+        if(_loading == carrier_loading::streamed)
+        {
+            return stream_read(0, 0, nullptr);
+        }
+        return (decode_size_header() / 8) - 8;
+    }
+
+    std::vector<uint8_t> steganographer::read_data_range(size_t offset, size_t length)
+    {
+        if(_loading == carrier_loading::streamed)
+        {
+            std::vector<uint8_t> result;
+            stream_read(offset, length, &result);
+            return result;
+        }
 
-        auto read_seq = [&](uint8_t px_sgmt, int bit_count)
+        size_t byte_count = read_data_size();
+        if(offset > byte_count)
         {
-            auto bits = get_last_bits(px_sgmt, bit_count);
-            std::copy(bits.begin(), bits.end(), std::back_inserter(read_bits));
-            size_t added_bits = bits.size();
-            report_counter += added_bits;
-            current_bit += added_bits;
-        };
+            throw_offset_past_end(offset, byte_count);
+        }
+        length = std::min(length, byte_count - offset);
 
-        size_t report_threshold = std::max(bit_len / 1000, (size_t)1);
+        require_encoded_bits(64 + ((offset + length) * 8));
 
-        while(current_bit < bit_len)
-        {            
-            auto av_bits = *space_it;
-            uint8_t* pxptr = _img->data() + (cur_pixel * 4);
+        std::vector<uint8_t> result;
+        result.resize(length, 0x00u);
+        extract_payload(offset, length, result.data());
+        return result;
+    }
 
-            if(!av_bits.is_zero())
+    image_save_options steganographer::carrier_save_options(image_save_options opt) const
+    {
+        // Lossy compression would destroy the data, and streamed images are
+        // written row by row, which only png supports
+        if((opt.format == image_format::jpeg) || (_loading == carrier_loading::streamed))
+        {
+            opt.format = image_format::png;
+        }
+        return opt;
+    }
+
+    void steganographer::save_to_file(const std::string& fname, image_save_options opt)
+    {
+        opt = carrier_save_options(opt);
+        if(_loading == carrier_loading::streamed)
+        {
+            // The carrier is still being read while the output is written
+            std::error_code ec;
+            if(!_fname.empty() && std::filesystem::equivalent(_fname, fname, ec))
             {
-                if(av_bits.r)
-                {
-                    read_seq(*(pxptr + 0), av_bits.r);
-                }
-                if(av_bits.g)
-                { 
-                    read_seq(*(pxptr + 1), av_bits.g);
-                }
-                if(av_bits.b)
-                { 
-                    read_seq(*(pxptr + 2), av_bits.b);
-                }
-                if(av_bits.a)
-                { 
-                    read_seq(*(pxptr + 3), av_bits.a);
-                }
+                throw std::invalid_argument(
+                    std::string("A streamed carrier can not be saved over itself: [") + fname + "]"
+                );
             }
 
-            ++space_it;
-            ++cur_pixel;
+            std::unique_ptr<image_reader> reader = open_reader();
+            image_writer writer(fname, reader->width(), reader->height(), opt);
+            stream_save(*reader, writer);
+            return;
         }
 
-        auto allbytes = get_bytes_from_bits(read_bits, 8);
-        size_t byte_count = (bit_len / 8) - 8;
-        std::vector<uint8_t> result;
-        result.reserve(byte_count);
+        if((opt.format != image_format::png) || !can_patch_source(fname))
+        {
+            _img->write_to_file(fname, opt);
+            return;
+        }
+
+        const size_t width = static_cast<size_t>(_img->width());
+        int first_row = 0;
+        int end_row = 0;
+        if(_changed_px_begin < _changed_px_end)
+        {
+            first_row = static_cast<int>(_changed_px_begin / width);
+            end_row = static_cast<int>((_changed_px_end + width - 1) / width);
+        }
 
-        std::copy(allbytes.begin() + 8, allbytes.begin() + 8 + byte_count, std::back_inserter(result));
+        image_writer writer(fname, _img->width(), _img->height(), opt);
+        if(!writer.patch_rows(_fname, _img->cdata(), first_row, end_row))
+        {
+            writer.write_rows(_img->cdata(), _img->height());
+        }
+    }
+
+    std::vector<uint8_t> steganographer::save_to_memory(image_save_options opt)
+    {
+        opt = carrier_save_options(opt);
+        if(_loading == carrier_loading::whole)
+        {
+            return _img->write_to_memory(opt);
+        }
+
+        std::vector<uint8_t> result;
+        {
+            std::unique_ptr<image_reader> reader = open_reader();
+            image_writer writer(result, reader->width(), reader->height(), opt);
+            stream_save(*reader, writer);
+        }
         return result;
     }
 
-    void steganographer::save_to_file(const std::string& fname)
+    bool steganographer::can_patch_source(const std::string& fname) const
     {
-        _img->write_to_file(fname);
+        // The source must still be the file the image was read from,
+        // and it is read while saving, so it cannot be overwritten
+        std::error_code ec;
+        if(_fname.empty()
+            || (std::filesystem::last_write_time(_fname, ec) != _source_time) || ec
+            || (std::filesystem::file_size(_fname, ec) != _source_size) || ec)
+        {
+            return false;
+        }
+
+        bool same_file = std::filesystem::equivalent(_fname, fname, ec);
+        return !same_file && !ec;
     }
 
-    size_t steganographer::decode_size_header(size_t& skipped_pixels)
+    size_t steganographer::decode_size_header()
     {        
-        _av_map->apply_thresholds();
-        auto& space_map = _av_map->available_map();
-        auto space_it = space_map.begin();
-        
-        std::vector<bool> sz_bits;
-        sz_bits.reserve(64);
+        _av_map->ensure_data_space(64);
+
+        uint8_t sz_bytes[8] = { };
+        extract_bits(0, 64, sz_bytes);
+        size_t bit_len = get_size_from_bytes(sz_bytes);
+
+        if(bit_len < 64)
+        {
+            throw_invalid_header();
+        }
+        return bit_len;
+    }
+
+    void steganographer::require_encoded_bits(size_t bit_len)
+    {
+        // A header pointing past the data space means the key does not match
+        if(bit_len > _av_map->ensure_data_space(bit_len))
+        {
+            throw_invalid_header();
+        }
+    }
+
+    void steganographer::embed_runs(
+        const uint8_t* data, 
+        size_t first_bit, 
+        size_t end_bit, 
+        size_t first_run, 
+        size_t last_run)
+    {
+        const auto& runs = _av_map->available_runs();
+        const auto& av_map = _av_map->available_map();
 
-        size_t cur_pixel = 0;
+        size_t current_bit = runs[first_run].bit_offset;
+        bit_reader bits(data, (end_bit - first_bit + 7) / 8);
+        bits.seek(std::max(current_bit, first_bit) - first_bit);
 
-        // Decode size header
-        while(sz_bits.size() < 64)
+        for(size_t run_idx = first_run; (run_idx < last_run) && (current_bit < end_bit); ++run_idx)
         {
-            auto av_bits = *space_it;
-            uint8_t* pxptr = _img->data() + (cur_pixel * 4);
+            const size_t run_end = runs[run_idx].first_px + runs[run_idx].px_count;
+            for(size_t px_idx = runs[run_idx].first_px; (px_idx < run_end) && (current_bit < end_bit); ++px_idx)
+            {
+                uint32_t mask = av_map.mask_at(px_idx);
+                if(mask == 0) { continue; }
+
+                size_t begin_bit = current_bit;
+                current_bit += popcount32(mask);
+                if(current_bit <= first_bit) { continue; }
 
-            if(!av_bits.is_zero())
+                embed_pixel(_img->pixel_at_idx(px_idx), mask, bits, begin_bit, first_bit, end_bit);
+            }
+        }
+    }
+
+    void steganographer::extract_bits(size_t first_bit, size_t bit_count, uint8_t* dst)
+    {
+        const auto& runs = _av_map->available_runs();
+        const auto& av_map = _av_map->available_map();
+        const size_t end_bit = first_bit + bit_count;
+
+        bit_writer writer(dst, (bit_count + 7) / 8);
+
+        size_t run_idx = _av_map->find_run(first_bit);
+        for(; (run_idx < runs.size()) && (writer.position() < bit_count); ++run_idx)
+        {
+            size_t current_bit = runs[run_idx].bit_offset;
+            const size_t run_end = runs[run_idx].first_px + runs[run_idx].px_count;
+            for(size_t px_idx = runs[run_idx].first_px; (px_idx < run_end) && (current_bit < end_bit); ++px_idx)
             {
-                if(av_bits.r)
+                uint32_t mask = av_map.mask_at(px_idx);
+                if(mask == 0) { continue; }
+
+                size_t count = popcount32(mask);
+                size_t begin_bit = current_bit;
+                current_bit += count;
+                if(current_bit <= first_bit) { continue; }
+
+                uint32_t bits = extract_pixel_bits(load_pixel_word(_img->cpixel_at_idx(px_idx)), mask);
+                write_bit_range(writer, bits, begin_bit, count, first_bit, end_bit);
+            }
+        }
+
+        writer.flush();
+    }
+
+    std::unique_ptr<image_reader> steganographer::open_reader()
+    {
+        if(_reader) { return std::move(_reader); }
+        if(_fname.empty())
+        {
+            throw std::logic_error("The image stream can only be read once");
+        }
+        return std::make_unique<image_reader>(_fname);
+    }
+
+    size_t steganographer::stream_read(size_t offset, size_t length, std::vector<uint8_t>* dst)
+    {
+        std::unique_ptr<image_reader> reader = open_reader();
+        threshold_engine engine(_av_map->thresholds());
+
+        const size_t row_px = static_cast<size_t>(reader->width());
+        const int batch_rows = reader->batch_rows();
+        std::vector<uint8_t> pixels(batch_rows * row_px * 4);
+        std::vector<uint32_t> masks(batch_rows * row_px);
+
+        uint8_t sz_bytes[8] = { };
+        bit_writer header_writer(sz_bytes, 8);
+        std::unique_ptr<bit_writer> data_writer;
+        bool header_done = false;
+        size_t byte_count = 0;
+        size_t first_bit = 64;
+        size_t end_bit = 64;
+        size_t current_bit = 0;
+
+        // Rows are only decoded until the requested range has been read
+        while(current_bit < end_bit)
+        {
+            int rows = reader->read_rows(pixels.data(), batch_rows);
+            if(rows == 0) { throw_invalid_header(); }
+
+            size_t px_count = rows * row_px;
+            availability_map::evaluate_masks(engine, pixels.data(), px_count, masks.data());
+
+            for(size_t px_idx = 0; (px_idx < px_count) && (current_bit < end_bit); ++px_idx)
+            {
+                uint32_t mask = masks[px_idx];
+                if(mask == 0) { continue; }
+
+                size_t count = popcount32(mask);
+                size_t begin_bit = current_bit;
+                current_bit += count;
+                uint32_t bits = extract_pixel_bits(load_pixel_word(pixels.data() + (px_idx * 4)), mask);
+
+                if(!header_done)
                 {
-                    auto bits = get_last_bits(*(pxptr + 0), av_bits.r);
-                    std::copy(bits.begin(), bits.end(), std::back_inserter(sz_bits));
-                }
-                if(av_bits.g) 
-                { 
-                    auto bits = get_last_bits(*(pxptr + 1), av_bits.g); 
-                    std::copy(bits.begin(), bits.end(), std::back_inserter(sz_bits));
-                }
-                if(av_bits.b) 
-                { 
-                    auto bits = get_last_bits(*(pxptr + 2), av_bits.b); 
-                    std::copy(bits.begin(), bits.end(), std::back_inserter(sz_bits));
-                }
-                if(av_bits.a) 
-                { 
-                    auto bits = get_last_bits(*(pxptr + 3), av_bits.a); 
-                    std::copy(bits.begin(), bits.end(), std::back_inserter(sz_bits));
+                    write_bit_range(header_writer, bits, begin_bit, count, 0, 64);
+                    if(current_bit < 64) { continue; }
+
+                    header_writer.flush();
+                    header_done = true;
+                    // A header past what the image can hold means the key does not match
+                    size_t bit_len = get_size_from_bytes(sz_bytes);
+                    if((bit_len < 64) || (bit_len > reader->pixel_count() * 32)) { throw_invalid_header(); }
+
+                    byte_count = (bit_len / 8) - 8;
+                    if(dst == nullptr) { return byte_count; }
+                    if(offset > byte_count) { throw_offset_past_end(offset, byte_count); }
+
+                    length = std::min(length, byte_count - offset);
+                    dst->assign(length, 0x00u);
+                    if(length == 0) { return byte_count; }
+
+                    data_writer = std::make_unique<bit_writer>(dst->data(), length);
+                    first_bit = 64 + (offset * 8);
+                    end_bit = first_bit + (length * 8);
                 }
+                write_bit_range(*data_writer, bits, begin_bit, count, first_bit, end_bit);
             }
-
-            ++space_it;
-            ++cur_pixel;
         }
 
-        skipped_pixels = cur_pixel;
+        data_writer->flush();
+        return byte_count;
+    }
+
+    void steganographer::stream_save(image_reader& reader, image_writer& writer)
+    {
+        threshold_engine engine(_av_map->thresholds());
+
+        const size_t row_px = static_cast<size_t>(reader.width());
+        const int batch_rows = reader.batch_rows();
+        std::vector<uint8_t> pixels(batch_rows * row_px * 4);
+        std::vector<uint32_t> masks(batch_rows * row_px);
 
-        sz_bits.resize(64, 0x00u); // clamp to 64 bits
-        std::vector<uint8_t> sz_bytes = get_size_bytes_from_bits(sz_bits);
-        return get_size_from_bytes(sz_bytes);
+        const size_t bit_len = _pending_data.size() * 8;
+        bit_reader bits(_pending_data.data(), _pending_data.size());
+        size_t current_bit = 0;
+
+        while(int rows = reader.read_rows(pixels.data(), batch_rows))
+        {
+            size_t px_count = rows * row_px;
+            if(current_bit < bit_len)
+            {
+                availability_map::evaluate_masks(engine, pixels.data(), px_count, masks.data());
+                for(size_t px_idx = 0; (px_idx < px_count) && (current_bit < bit_len); ++px_idx)
+                {
+                    uint32_t mask = masks[px_idx];
+                    if(mask == 0) { continue; }
+
+                    embed_pixel(pixels.data() + (px_idx * 4), mask, bits, current_bit, 0, bit_len);
+                    current_bit += popcount32(mask);
+                }
+            }
+
+            // Before the last rows, so an incomplete image is never saved
+            if((reader.rows_read() == reader.height()) && (current_bit < bit_len))
+            {
+                throw_not_enough_space(bit_len, current_bit);
+            }
+            writer.write_rows(pixels.data(), rows);
+        }
     }
-}
+}
\ No newline at end of file
@@ -0,0 +1,301 @@
+#include <xsteg/threshold_engine.hpp>
+
+#include <xsteg/packed_availability_map.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+namespace xsteg
+{
+    // One slot per visual_data_type at most
+    static const size_t MAX_VDATA_SLOTS = 8;
+
+    // Pixels whose keys are computed at once by evaluate_span, on the stack
+    static const size_t KEY_BLOCK_PX = 512;
+
+    threshold_word_ops::threshold_word_ops(const pixel_availability& bits)
+    {
+        const int channels[4] = { bits.r, bits.g, bits.b, bits.a };
+        for(int i = 0; i < 4; ++i)
+        {
+            if(channels[i] < 0) { continue; }
+            int shift = (3 - i) * 4;
+            keep &= static_cast<uint16_t>(~(0x0Fu << shift));
+            set |= static_cast<uint16_t>(channels[i] << shift);
+        }
+    }
+
+    threshold_engine::threshold_engine(const std::vector<availability_threshold>& thresholds)
+    {
+        for(auto it = thresholds.rbegin(); it != thresholds.rend(); ++it)
+        {
+            compiled_threshold compiled;
+            threshold_word_ops ops(it->bits);
+            compiled.cuts = make_cuts(*it);
+            compiled.channels = static_cast<uint16_t>(~ops.keep);
+            compiled.set = ops.set;
+            _reversed.push_back(compiled);
+        }
+
+        // Visual data is truncated with the bits of the first threshold of its type
+        for(size_t i = 0; i < thresholds.size(); ++i)
+        {
+            auto slot_it = std::find_if(_slots.begin(), _slots.end(), 
+                [&](const vdata_slot& slot)
+                {
+                    return slot.type == thresholds[i].data_type;
+                });
+
+            if(slot_it == _slots.end())
+            {
+                const pixel_availability& bits = thresholds[i].bits;
+                vdata_slot slot;
+                slot.type = thresholds[i].data_type;
+                slot.truncate_masks[0] = truncation_mask(bits.r);
+                slot.truncate_masks[1] = truncation_mask(bits.g);
+                slot.truncate_masks[2] = truncation_mask(bits.b);
+                slot.truncate_masks[3] = truncation_mask(bits.a);
+                _slots.push_back(slot);
+                slot_it = _slots.end() - 1;
+            }
+            _reversed[thresholds.size() - 1 - i].vdata_slot = 
+                static_cast<size_t>(std::distance(_slots.begin(), slot_it));
+        }
+        assert(_slots.size() <= MAX_VDATA_SLOTS);
+
+        build_tables();
+        for(const compiled_threshold& thres : _reversed)
+        {
+            if(!thres.by_table)
+            {
+                _keyed_slots |= (1u << thres.vdata_slot);
+            }
+        }
+    }
+
+    void threshold_engine::build_tables()
+    {
+        if(_reversed.empty() || (_reversed.size() > 32)) { return; }
+
+        bool all_by_table = true;
+        std::vector<size_t> used_channels;
+        for(size_t i = 0; i < _reversed.size(); ++i)
+        {
+            compiled_threshold& thres = _reversed[i];
+            const vdata_slot& slot = _slots[thres.vdata_slot];
+            int channel = visual_data_channel(slot.type);
+            if(channel < 0)
+            {
+                all_by_table = false;
+                continue;
+            }
+
+            for(size_t byte = 0; byte < 256; ++byte)
+            {
+                uint16_t key = static_cast<uint16_t>(byte & slot.truncate_masks[channel]);
+                if((key >= thres.cuts[0].from) && (key < thres.cuts[0].to))
+                {
+                    _channel_passes[channel][byte] |= (1u << i);
+                }
+            }
+            thres.by_table = true;
+            _use_channel_passes = true;
+
+            if(std::find(used_channels.begin(), used_channels.end(), channel) == used_channels.end())
+            {
+                used_channels.push_back(static_cast<size_t>(channel));
+            }
+        }
+
+        if(!all_by_table || (used_channels.size() > 2)) { return; }
+
+        // Every other byte of the pixel is irrelevant to the thresholds
+        const size_t table_size = (used_channels.size() == 1) ? 0x100 : 0x10000;
+        std::vector<uint16_t> table(table_size);
+        for(size_t idx = 0; idx < table_size; ++idx)
+        {
+            uint8_t px[4] = { };
+            if(used_channels.size() == 1)
+            {
+                px[used_channels[0]] = static_cast<uint8_t>(idx);
+            }
+            else
+            {
+                px[used_channels[0]] = static_cast<uint8_t>(idx >> 8);
+                px[used_channels[1]] = static_cast<uint8_t>(idx);
+            }
+            table[idx] = evaluate(px);
+        }
+
+        _table_channels[0] = used_channels[0];
+        _table_channels[1] = used_channels.back();
+        _word_table = std::move(table);
+    }
+
+    std::vector<threshold_cut> threshold_engine::make_cuts(const availability_threshold& thres)
+    {
+        const size_t key_count = visual_data_key_count(thres.data_type);
+        const size_t row_count = visual_data_row_count(thres.data_type);
+
+        std::vector<threshold_cut> result;
+        for(size_t row = 0; row < row_count; ++row)
+        {
+            // The float values only grow with the key, so the passing keys are contiguous
+            threshold_cut cut;
+            bool found = false;
+            for(size_t key = 0; key < key_count; ++key)
+            {
+                visual_data_key vkey = { static_cast<uint16_t>(key), static_cast<uint8_t>(row) };
+                float val = get_visual_data_from_key(vkey, thres.data_type);
+                bool cond = (thres.direction == threshold_direction::UP)
+                            ? val >= thres.value
+                            : val <= thres.value;
+                if(!cond) { continue; }
+
+                if(!found)
+                {
+                    cut.from = static_cast<uint16_t>(key);
+                    found = true;
+                }
+                assert(cut.to == 0 || cut.to == key);
+                cut.to = static_cast<uint16_t>(key + 1);
+            }
+            result.push_back(cut);
+        }
+        return result;
+    }
+
+    uint16_t threshold_engine::evaluate(const uint8_t* px) const
+    {
+        if(_word_table.size() == 0x100)
+        {
+            return _word_table[px[_table_channels[0]]];
+        }
+        if(_word_table.size() == 0x10000)
+        {
+            return _word_table[(px[_table_channels[0]] << 8) | px[_table_channels[1]]];
+        }
+
+        return evaluate_thresholds(px, [&](size_t slot_idx)
+        {
+            const vdata_slot& slot = _slots[slot_idx];
+            const uint8_t tpx[4] = 
+            {
+                static_cast<uint8_t>(px[0] & slot.truncate_masks[0]),
+                static_cast<uint8_t>(px[1] & slot.truncate_masks[1]),
+                static_cast<uint8_t>(px[2] & slot.truncate_masks[2]),
+                static_cast<uint8_t>(px[3] & slot.truncate_masks[3])
+            };
+            return get_visual_data_key(tpx, slot.type);
+        });
+    }
+
+    void threshold_engine::evaluate_span(const uint8_t* px, size_t count, uint16_t* words) const
+    {
+        // Tables already decide a pixel with one or two lookups
+        if(!_word_table.empty() || (_keyed_slots == 0))
+        {
+            for(size_t i = 0; i < count; ++i)
+            {
+                words[i] = evaluate(px + (i * 4));
+            }
+            return;
+        }
+
+        uint16_t keys[MAX_VDATA_SLOTS][KEY_BLOCK_PX];
+        uint8_t rows[MAX_VDATA_SLOTS][KEY_BLOCK_PX];
+        for(size_t from = 0; from < count; from += KEY_BLOCK_PX)
+        {
+            const size_t block_px = std::min(KEY_BLOCK_PX, count - from);
+            const uint8_t* block = px + (from * 4);
+            for(size_t slot_idx = 0; slot_idx < _slots.size(); ++slot_idx)
+            {
+                if(_keyed_slots & (1u << slot_idx))
+                {
+                    const vdata_slot& slot = _slots[slot_idx];
+                    get_visual_data_keys(block, block_px, slot.type, slot.truncate_masks, keys[slot_idx], rows[slot_idx]);
+                }
+            }
+
+            for(size_t i = 0; i < block_px; ++i)
+            {
+                words[from + i] = evaluate_thresholds(block + (i * 4), [&](size_t slot_idx)
+                {
+                    // Only SATURATION has rows
+                    const bool has_rows = (_slots[slot_idx].type == visual_data_type::SATURATION);
+                    return visual_data_key { keys[slot_idx][i], has_rows ? rows[slot_idx][i] : uint8_t(0) };
+                });
+            }
+        }
+    }
+
+    uint16_t threshold_engine::evaluate_key(visual_data_key key) const
+    {
+        assert(_slots.size() <= 1);
+
+        uint16_t word = packed_availability_map::UNSET_WORD;
+        uint16_t decided = 0;
+        for(const compiled_threshold& thres : _reversed)
+        {
+            uint16_t channels = thres.channels & static_cast<uint16_t>(~decided);
+            const threshold_cut& cut = thres.cuts[key.row];
+            if((channels != 0) && (key.key >= cut.from) && (key.key < cut.to))
+            {
+                word = static_cast<uint16_t>((word & ~channels) | (thres.set & channels));
+                decided |= channels;
+            }
+        }
+        return word;
+    }
+
+    template<typename KeyOf>
+    uint16_t threshold_engine::evaluate_thresholds(const uint8_t* px, const KeyOf& key_of) const
+    {
+        uint32_t passes = 0;
+        if(_use_channel_passes)
+        {
+            passes = _channel_passes[0][px[0]] 
+                   | _channel_passes[1][px[1]] 
+                   | _channel_passes[2][px[2]] 
+                   | _channel_passes[3][px[3]];
+        }
+
+        visual_data_key keys[MAX_VDATA_SLOTS];
+        uint32_t computed = 0;
+        uint16_t word = packed_availability_map::UNSET_WORD;
+        uint16_t decided = 0;
+
+        for(size_t i = 0; i < _reversed.size(); ++i)
+        {
+            const compiled_threshold& thres = _reversed[i];
+            uint16_t channels = thres.channels & static_cast<uint16_t>(~decided);
+            if(channels == 0) { continue; }
+
+            bool passed;
+            if(thres.by_table)
+            {
+                passed = (passes & (1u << i)) != 0;
+            }
+            else
+            {
+                if(!(computed & (1u << thres.vdata_slot)))
+                {
+                    keys[thres.vdata_slot] = key_of(thres.vdata_slot);
+                    computed |= (1u << thres.vdata_slot);
+                }
+
+                const visual_data_key& key = keys[thres.vdata_slot];
+                const threshold_cut& cut = thres.cuts[key.row];
+                passed = (key.key >= cut.from) && (key.key < cut.to);
+            }
+
+            if(passed)
+            {
+                word = static_cast<uint16_t>((word & ~channels) | (thres.set & channels));
+                decided |= channels;
+                if(decided == 0xFFFFu) { break; }
+            }
+        }
+        return word;
+    }
+}
@@ -8,81 +8,228 @@
 
 #include <xsteg/availability_map.hpp>
 
+#if defined(__AVX2__)
+    #define XSTEG_HAS_AVX2 1
+#else
+    #define XSTEG_HAS_AVX2 0
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define XSTEG_HAS_SSE2 1
+    #include <immintrin.h>
+#else
+    #define XSTEG_HAS_SSE2 0
+#endif
+
 #define SCFLOAT(x) static_cast<float>(x)
 #define SCINT(x) static_cast<int>(x)
 
 namespace xsteg
 {
-	const std::array<uint8_t, 8> truncation_masks
-	{
-		0xFFu, 0xFEu, 0xFCu, 0xF8u,
-        0xF0u, 0xE0u, 0xC0u, 0x80u
-	};
+#if XSTEG_HAS_SSE2
+    struct sse2_ops
+    {
+        typedef __m128i vint;
+        static constexpr size_t width = 4;
 
-    float get_visual_data(
-        const uint8_t* px, 
-        visual_data_type type, 
-        pixel_availability truncate_bits)
+        static vint load(const uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+        static vint set1(uint32_t v) { return _mm_set1_epi32(static_cast<int>(v)); }
+        static vint band(vint a, vint b) { return _mm_and_si128(a, b); }
+        static vint add(vint a, vint b) { return _mm_add_epi32(a, b); }
+        static vint sub(vint a, vint b) { return _mm_sub_epi32(a, b); }
+        // Lanes hold bytes only, so 16 bit comparisons are enough
+        static vint max(vint a, vint b) { return _mm_max_epi16(a, b); }
+        static vint min(vint a, vint b) { return _mm_min_epi16(a, b); }
+        template<int N> static vint srl(vint a) { return _mm_srli_epi32(a, N); }
+        // Narrowing, keeping the lanes of 'a' before those of 'b'
+        static vint pack16(vint a, vint b) { return _mm_packs_epi32(a, b); }
+        static vint pack8(vint a, vint b) { return _mm_packus_epi16(a, b); }
+        static void store(void* p, vint v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+    };
+#endif
+
+#if XSTEG_HAS_AVX2
+    struct avx2_ops
     {
-        assert(truncate_bits.r < 8 && truncate_bits.r >= -1);
-        assert(truncate_bits.g < 8 && truncate_bits.g >= -1);
-        assert(truncate_bits.b < 8 && truncate_bits.b >= -1);
-        assert(truncate_bits.a < 8 && truncate_bits.a >= -1);
+        typedef __m256i vint;
+        static constexpr size_t width = 8;
 
-        uint8_t tpx[4];
-        std::memcpy(tpx, px, 4);
+        static vint load(const uint8_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+        static vint set1(uint32_t v) { return _mm256_set1_epi32(static_cast<int>(v)); }
+        static vint band(vint a, vint b) { return _mm256_and_si256(a, b); }
+        static vint add(vint a, vint b) { return _mm256_add_epi32(a, b); }
+        static vint sub(vint a, vint b) { return _mm256_sub_epi32(a, b); }
+        static vint max(vint a, vint b) { return _mm256_max_epi32(a, b); }
+        static vint min(vint a, vint b) { return _mm256_min_epi32(a, b); }
+        template<int N> static vint srl(vint a) { return _mm256_srli_epi32(a, N); }
+        // AVX2 packs within 128 bit halves, the permute puts them back in order
+        static vint pack16(vint a, vint b) { return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8); }
+        static vint pack8(vint a, vint b) { return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8); }
+        static void store(void* p, vint v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    };
+#endif
 
-        tpx[0] &= truncation_masks[std::max(truncate_bits.r, 0)];
-        tpx[1] &= truncation_masks[std::max(truncate_bits.g, 0)];
-        tpx[2] &= truncation_masks[std::max(truncate_bits.b, 0)];
-        tpx[3] &= truncation_masks[std::max(truncate_bits.a, 0)];
+    // Key (and row) of V::width pixels, as in get_visual_data_key
+    template<typename V, visual_data_type TYPE>
+    static inline typename V::vint get_visual_data_key_vector(
+        const uint8_t* px, 
+        typename V::vint trunc, 
+        typename V::vint& row)
+    {
+        const typename V::vint byte = V::set1(0xFFu);
+        typename V::vint word = V::band(V::load(px), trunc);
+        typename V::vint r = V::band(word, byte);
+        typename V::vint g = V::band(V::template srl<8>(word), byte);
+        typename V::vint b = V::band(V::template srl<16>(word), byte);
 
-        switch (type)
+        switch(TYPE)
         {
-            case visual_data_type::AVERAGE_VALUE_RGB:
+            case visual_data_type::AVERAGE_VALUE_RGB:   { return V::add(V::add(r, g), b); }
+            case visual_data_type::AVERAGE_VALUE_RGBA:  { return V::add(V::add(V::add(r, g), b), V::template srl<24>(word)); }
+            case visual_data_type::ALPHA:               { return V::template srl<24>(word); }
+            case visual_data_type::COLOR_BLUE:          { return b; }
+            case visual_data_type::COLOR_GREEN:         { return g; }
+            case visual_data_type::COLOR_RED:           { return r; }
+            case visual_data_type::LUMINANCE:
             {
-                return SCFLOAT(
-                    std::accumulate(tpx, tpx + 3, 0)) / 3.0F / 255.0F;
+                return V::add(V::max(V::max(r, g), b), V::min(V::min(r, g), b));
             }
-            case visual_data_type::AVERAGE_VALUE_RGBA:
+            case visual_data_type::SATURATION:
             {
-                return SCFLOAT(
-                    std::accumulate(tpx, tpx + 4, 0)) / 4.0F / 255.0F;
+                row = V::max(V::max(r, g), b);
+                return V::sub(row, V::min(V::min(r, g), b));
             }
-            case visual_data_type::ALPHA:
+            default: { return V::set1(0); }
+        }
+    }
+
+    // Four vectors of pixels per iteration, so keys and rows are stored whole.
+    // Returns how many pixels were processed.
+    template<typename V, visual_data_type TYPE>
+    static size_t get_visual_data_key_block(
+        const uint8_t* px, 
+        size_t count, 
+        uint32_t truncation_word,
+        uint16_t* keys,
+        uint8_t* rows)
+    {
+        constexpr size_t step = V::width * 4;
+        const typename V::vint trunc = V::set1(truncation_word);
+
+        size_t i = 0;
+        for(; i + step <= count; i += step)
+        {
+            typename V::vint k[4];
+            typename V::vint r[4];
+            for(size_t v = 0; v < 4; ++v)
             {
-                return SCFLOAT(tpx[3]) / 255.0F;
+                k[v] = get_visual_data_key_vector<V, TYPE>(px + ((i + (v * V::width)) * 4), trunc, r[v]);
             }
-            case visual_data_type::COLOR_BLUE:
+
+            V::store(keys + i, V::pack16(k[0], k[1]));
+            V::store(keys + i + (V::width * 2), V::pack16(k[2], k[3]));
+            if(TYPE == visual_data_type::SATURATION)
             {
-                return SCFLOAT(tpx[2]) / 255.0F;
+                V::store(rows + i, V::pack8(V::pack16(r[0], r[1]), V::pack16(r[2], r[3])));
             }
+        }
+        return i;
+    }
+
+    template<typename V>
+    static size_t get_visual_data_key_block(
+        const uint8_t* px, 
+        size_t count, 
+        visual_data_type type, 
+        uint32_t truncation_word,
+        uint16_t* keys,
+        uint8_t* rows)
+    {
+        switch(type)
+        {
+            case visual_data_type::AVERAGE_VALUE_RGB:
+                return get_visual_data_key_block<V, visual_data_type::AVERAGE_VALUE_RGB>(px, count, truncation_word, keys, rows);
+            case visual_data_type::AVERAGE_VALUE_RGBA:
+                return get_visual_data_key_block<V, visual_data_type::AVERAGE_VALUE_RGBA>(px, count, truncation_word, keys, rows);
+            case visual_data_type::ALPHA:
+                return get_visual_data_key_block<V, visual_data_type::ALPHA>(px, count, truncation_word, keys, rows);
+            case visual_data_type::COLOR_BLUE:
+                return get_visual_data_key_block<V, visual_data_type::COLOR_BLUE>(px, count, truncation_word, keys, rows);
             case visual_data_type::COLOR_GREEN:
-            {
-                return SCFLOAT(tpx[1]) / 255.0F;
-            }
+                return get_visual_data_key_block<V, visual_data_type::COLOR_GREEN>(px, count, truncation_word, keys, rows);
             case visual_data_type::COLOR_RED:
-            {
-                return SCFLOAT(tpx[0]) / 255.0F;
-            }
+                return get_visual_data_key_block<V, visual_data_type::COLOR_RED>(px, count, truncation_word, keys, rows);
             case visual_data_type::LUMINANCE:
-            {
-				uint8_t max_rgb = std::max({ tpx[0], tpx[1], tpx[2] });
-				uint8_t min_rgb = std::min({ tpx[0], tpx[1], tpx[2] });
-
-                return std::abs((0.5F * (max_rgb + min_rgb)) / 255.0F);
-            }
+                return get_visual_data_key_block<V, visual_data_type::LUMINANCE>(px, count, truncation_word, keys, rows);
             case visual_data_type::SATURATION:
-            {
-				uint8_t max_rgb = std::max({tpx[0], tpx[1], tpx[2]});
-				uint8_t min_rgb = std::min({tpx[0], tpx[1], tpx[2]});
+                return get_visual_data_key_block<V, visual_data_type::SATURATION>(px, count, truncation_word, keys, rows);
+            default: 
+                return 0;
+        }
+    }
 
-                return SCFLOAT(max_rgb - min_rgb) / max_rgb;
+    void get_visual_data_keys(
+        const uint8_t* px, 
+        size_t count, 
+        visual_data_type type, 
+        const uint8_t* truncate_masks,
+        uint16_t* keys,
+        uint8_t* rows)
+    {
+        size_t done = 0;
+#if XSTEG_HAS_SSE2
+        // Pixels are loaded as little endian words, red in the lowest byte
+        const uint32_t truncation_word = truncate_masks[0] 
+                                       | (truncate_masks[1] << 8) 
+                                       | (truncate_masks[2] << 16) 
+                                       | (static_cast<uint32_t>(truncate_masks[3]) << 24);
+    #if XSTEG_HAS_AVX2
+        done = get_visual_data_key_block<avx2_ops>(px, count, type, truncation_word, keys, rows);
+    #else
+        done = get_visual_data_key_block<sse2_ops>(px, count, type, truncation_word, keys, rows);
+    #endif
+#endif
+
+        for(size_t i = done; i < count; ++i)
+        {
+            const uint8_t* pxptr = px + (i * 4);
+            const uint8_t tpx[4] = 
+            {
+                static_cast<uint8_t>(pxptr[0] & truncate_masks[0]),
+                static_cast<uint8_t>(pxptr[1] & truncate_masks[1]),
+                static_cast<uint8_t>(pxptr[2] & truncate_masks[2]),
+                static_cast<uint8_t>(pxptr[3] & truncate_masks[3])
+            };
+            visual_data_key key = get_visual_data_key(tpx, type);
+            keys[i] = key.key;
+            if(type == visual_data_type::SATURATION)
+            {
+                rows[i] = key.row;
             }
-            default: return 0;
         }
     }
 
+    float get_visual_data(
+        const uint8_t* px, 
+        visual_data_type type, 
+        pixel_availability truncate_bits)
+    {
+        assert(truncate_bits.r <= 8 && truncate_bits.r >= -1);
+        assert(truncate_bits.g <= 8 && truncate_bits.g >= -1);
+        assert(truncate_bits.b <= 8 && truncate_bits.b >= -1);
+        assert(truncate_bits.a <= 8 && truncate_bits.a >= -1);
+
+        uint8_t tpx[4];
+        std::memcpy(tpx, px, 4);
+
+        tpx[0] &= truncation_mask(truncate_bits.r);
+        tpx[1] &= truncation_mask(truncate_bits.g);
+        tpx[2] &= truncation_mask(truncate_bits.b);
+        tpx[3] &= truncation_mask(truncate_bits.a);
+
+        return get_truncated_visual_data(tpx, type);
+    }
+
     std::vector<float> get_visual_data_map(
         const image* img, 
         visual_data_type type,
@@ -0,0 +1,90 @@
+#include <xsteg/visual_data_histogram.hpp>
+
+#include <xsteg/worker_pool.hpp>
+
+#include <algorithm>
+#include <mutex>
+
+namespace xsteg
+{
+    static const size_t MIN_SEGMENT_PX = 1 << 16;
+
+    // Pixels whose keys are computed at once, on the stack
+    static const size_t KEY_BLOCK_PX = 1024;
+
+    visual_data_histogram::visual_data_histogram(
+        const image* img, 
+        visual_data_type type, 
+        pixel_availability truncate_bits)
+    {
+        _type = type;
+        _key_count = visual_data_key_count(type);
+        _row_count = visual_data_row_count(type);
+        _pixel_count = img->pixel_count();
+        _counts.assign(_key_count * _row_count, 0);
+
+        const uint8_t masks[4] = 
+        {
+            truncation_mask(truncate_bits.r),
+            truncation_mask(truncate_bits.g),
+            truncation_mask(truncate_bits.b),
+            truncation_mask(truncate_bits.a)
+        };
+
+        // Every segment counts into its own bins, merged at the end
+        worker_pool& pool = worker_pool::shared();
+        const size_t segment_count = std::clamp<size_t>(
+            _pixel_count / MIN_SEGMENT_PX, 1, pool.thread_count());
+        const size_t segment_px = _pixel_count / segment_count;
+        std::mutex merge_lock;
+
+        pool.parallel_for(segment_count, [&](size_t i)
+        {
+            size_t from_px = i * segment_px;
+            size_t to_px = (i == segment_count - 1) ? _pixel_count : (from_px + segment_px);
+
+            std::vector<uint64_t> counts(_counts.size(), 0);
+            uint16_t keys[KEY_BLOCK_PX];
+            uint8_t rows[KEY_BLOCK_PX];
+            for(size_t pxi = from_px; pxi < to_px; pxi += KEY_BLOCK_PX)
+            {
+                const size_t block_px = std::min(KEY_BLOCK_PX, to_px - pxi);
+                get_visual_data_keys(img->cdata() + (pxi * 4), block_px, _type, masks, keys, rows);
+                if(_row_count == 1)
+                {
+                    for(size_t j = 0; j < block_px; ++j) { ++counts[keys[j]]; }
+                }
+                else
+                {
+                    for(size_t j = 0; j < block_px; ++j) { ++counts[(rows[j] * _key_count) + keys[j]]; }
+                }
+            }
+
+            std::lock_guard lock(merge_lock);
+            for(size_t bin = 0; bin < counts.size(); ++bin)
+            {
+                _counts[bin] += counts[bin];
+            }
+        });
+    }
+
+    visual_data_type visual_data_histogram::type() const
+    {
+        return _type;
+    }
+
+    size_t visual_data_histogram::key_count() const
+    {
+        return _key_count;
+    }
+
+    size_t visual_data_histogram::row_count() const
+    {
+        return _row_count;
+    }
+
+    size_t visual_data_histogram::pixel_count() const
+    {
+        return _pixel_count;
+    }
+}
@@ -0,0 +1,133 @@
+#include <xsteg/worker_pool.hpp>
+
+#include <algorithm>
+
+namespace xsteg
+{
+    static thread_local bool inside_pool_task = false;
+
+    worker_pool::worker_pool(size_t thread_count)
+    {
+        for(size_t i = 1; i < thread_count; ++i)
+        {
+            _workers.push_back(std::thread(&worker_pool::worker_loop, this));
+        }
+    }
+
+    worker_pool::~worker_pool()
+    {
+        {
+            std::lock_guard lock(_lock);
+            _stopping = true;
+        }
+        _work_cv.notify_all();
+
+        for(auto& th : _workers)
+        {
+            th.join();
+        }
+    }
+
+    size_t worker_pool::thread_count() const
+    {
+        return _workers.size() + 1;
+    }
+
+    void worker_pool::parallel_for(size_t task_count, const task_t& task)
+    {
+        if(_workers.empty() || (task_count <= 1) || inside_pool_task)
+        {
+            for(size_t i = 0; i < task_count; ++i)
+            {
+                task(i);
+            }
+            return;
+        }
+
+        std::lock_guard submit_lock(_submit_lock);
+        {
+            // Workers still leaving the previous job may be reading it
+            std::unique_lock lock(_lock);
+            _done_cv.wait(lock, [&]() { return _active_workers == 0; });
+
+            _task = &task;
+            _task_count = task_count;
+            _next_task = 0;
+            _pending_tasks = task_count;
+            _error = nullptr;
+            ++_generation;
+        }
+        _work_cv.notify_all();
+
+        run_tasks();
+
+        std::unique_lock lock(_lock);
+        _done_cv.wait(lock, [&]() { return _pending_tasks == 0; });
+        _task = nullptr;
+
+        if(_error)
+        {
+            std::rethrow_exception(_error);
+        }
+    }
+
+    worker_pool& worker_pool::shared()
+    {
+        static worker_pool pool(std::max(std::thread::hardware_concurrency(), 1u));
+        return pool;
+    }
+
+    void worker_pool::worker_loop()
+    {
+        size_t seen_generation = 0;
+        while(true)
+        {
+            {
+                std::unique_lock lock(_lock);
+                _work_cv.wait(lock, [&]() 
+                { 
+                    return _stopping || (_generation != seen_generation); 
+                });
+
+                if(_stopping) { return; }
+                seen_generation = _generation;
+                ++_active_workers;
+            }
+
+            run_tasks();
+
+            {
+                std::lock_guard lock(_lock);
+                --_active_workers;
+            }
+            _done_cv.notify_all();
+        }
+    }
+
+    void worker_pool::run_tasks()
+    {
+        inside_pool_task = true;
+        while(true)
+        {
+            size_t idx = _next_task.fetch_add(1);
+            if(idx >= _task_count) { break; }
+
+            try
+            {
+                (*_task)(idx);
+            }
+            catch(...)
+            {
+                std::lock_guard lock(_lock);
+                if(!_error) { _error = std::current_exception(); }
+            }
+
+            if(_pending_tasks.fetch_sub(1) == 1)
+            {
+                std::lock_guard lock(_lock);
+                _done_cv.notify_all();
+            }
+        }
+        inside_pool_task = false;
+    }
+}